@@ -12,6 +12,7 @@
 #define LOCAL_EDGE_DEVICE   ENABLE  // enable/disable local edge device
 #define HEARTBEAT_TIMER     DISABLE  // enable/disable heartbeat timer
 #define TIMEOUT_TIMER       DISABLE  // enable/disable timeout timer for reset
+#define UART_ASCII_COMMANDS ENABLE   // enable/disable legacy 5 byte ascii uart commands ("SEND-", "BCAST", ...)
 
 #define TAG_EDGE "EDGE"
 
@@ -26,12 +27,93 @@
 
 #define DEFAULT_MSG_SEND_TTL    2 // default value for message ttl, ttl changeable in runtime from command
 #define MSG_TIMEOUT             0
+
+// adaptive ttl - per destination ttl learned from received messages' remaining ttl, global ttl used when unknown
+#define MESH_TTL_ADAPTIVE       ENABLE
+#define MESH_TTL_MAX_PEERS      16          // destinations whose hop distance is tracked, least recently heard replaced
+#define MESH_TTL_MARGIN         1           // ttl added above the learned minimum, absorbs small route changes
+#define MESH_TTL_WINDOW_US      60000000    // largest hop estimate kept for 60s, then relearned so shorter routes show up
+#define MESH_TTL_EXPIRE_US      300000000   // back to global ttl when nothing heard from destination for 5min
 #define MSG_ROLE_ROOT           ROLE_PROVISIONER
 #define MSG_ROLE_EDGE           ROLE_NODE
 // #define MSG_ROLE_EDGE       ROLE_NODE // ROLE_FAST_PROV // ROLE_NODE
 
+// important message (reliable delivery) - 2 byte sequence number in payload, acked per sequence by receiver
+#define MESH_RELIABLE_HDR_LEN           2       // sequence number header in front of every important message
+#define MESH_RELIABLE_MAX_MSG_LEN       256     // largest important message, sets pool slot size
+#define MESH_RELIABLE_POOL_SIZE         16      // important messages in flight across all destinations (max 255)
+#define MESH_RELIABLE_WINDOW            4       // important messages in flight per destination
+#define MESH_RELIABLE_MAX_PEERS         8       // destinations with important messages in flight at once
+#define MESH_RELIABLE_TIMEOUT_US        4000000  // first retransmit when no ack within 4s, doubled on every retransmit
+#define MESH_RELIABLE_MAX_BACKOFF_US    16000000 // cap on the doubled retransmit timeout
+#define MESH_RELIABLE_JITTER_PCT        25       // random 0-25% added to every timeout so nodes don't retry in lock-step
+#define MESH_RELIABLE_MAX_ATTEMPTS      4        // transmissions in total before giving up
+#define MESH_RELIABLE_DEADLINE_US       30000000 // give up 30s after first transmission regardless of attempts left
+
+// cumulative ack - receiver acks the highest contiguous sequence plus a bitmap of the 32 after it, once per few messages
+#define MESH_RELIABLE_CUMULATIVE_ACK    ENABLE   // send important messages as MESSAGE_IC, receiver handles both kinds regardless
+#define MESH_RELIABLE_CUM_HDR_LEN       3        // 2 byte sequence | 1 byte distance back to the oldest unacked sequence
+#define MESH_ACK_C_LEN                  6        // 2 byte highest contiguous sequence | 4 byte bitmap
+#define MESH_ACK_EVERY                  4        // ack after this many important messages from a node
+#define MESH_ACK_DELAY_US               100000   // or after this long since the first unacked one
+#define MESH_ACK_MAX_PEERS              8        // nodes acked in aggregate at once, least recently heard replaced
+
+// duplicate cache - received important messages by source and sequence, retransmits are acked again but not delivered twice
+#define MESH_DEDUP_SETS                 32       // hash sets, power of 2
+#define MESH_DEDUP_WAYS                 2        // entries per set, oldest one replaced when all are live
+#define MESH_DEDUP_EXPIRE_US            MESH_RELIABLE_DEADLINE_US // sender stops retransmitting by then
+
+// unsegmented fast path - access message of opcode + parameters up to 11 bytes goes out in one network pdu, no
+// transport acks or segment tx context, vendor opcode takes 3 so 8 bytes of message fit
+#define MESH_UNSEG_MAX_ACCESS_LEN   11
+#define MESH_VENDOR_OPCODE_LEN      3
+#define MESH_COMPACT_HEADERS        DISABLE // drop batch header on single sample telemetry so small samples stay unsegmented
+
+// outbound send queue - client model sends are queued and handed to the mesh stack one at a time
+// one lane per priority, served strictly in order below, each slot holds a full MESH_TXQ_MAX_MSG_LEN message
+#define MESH_TXQ_CONTROL_LEN        2       // control lane - reset, connectivity ping, host flagged control messages
+#define MESH_TXQ_RELIABLE_LEN       4       // reliable lane - important and response required messages
+#define MESH_TXQ_BULK_LEN           8       // bulk lane - normal messages, broadcast, telemetry
+#define MESH_TXQ_FAIRNESS_BURST     8       // waiting lane is served once passed over for higher lanes this many times
+#define MESH_TXQ_MAX_MSG_LEN        377     // 380 byte access message minus 3 byte vendor opcode
+#define MESH_TXQ_HIGH_WATER_PCT     75      // tell uart host to slow down once any lane is this full
+#define MESH_TXQ_LOW_WATER_PCT      25      // tell uart host to resume once every lane drained to this
+#define MESH_TXQ_MAX_RETRY          5       // resubmit when stack is busy or out of segment tx contexts
+#define MESH_TXQ_RETRY_DELAY_MS     50      // delay before first resubmit, doubled on every retry
+#define MESH_TXQ_COMP_TIMEOUT_MS    1000    // stop waiting for send complete event after this
+#define MESH_TXQ_STALE_SLOTS        4       // timed out sends whose late send complete event is still expected
+#define MESH_TXQ_STALE_TIMEOUT_MS   10000   // late send complete event no longer expected after this, segmented sends take a few s
+#define MESH_TXQ_RSP_SLOTS          4       // destinations with a response required send outstanding, more wait in their lane
+#define MESH_TXQ_RSP_TIMEOUT_MS     30000   // stop waiting for response or timeout event, well past the stack's client timeout
+
+// async send - per request completion callback for mesh_send_async()
+#define MESH_REQ_POOL_SIZE          32      // requests with a completion callback outstanding at once, uart host pipelines commands
+
+// large message transfer - message above the mesh SDU limit sent as fragments, receiver acks with a selective ack bitmap
+#define MESH_FRAG_HDR_LEN           5       // 1 byte transfer id | 2 byte total length | 2 byte fragment index
+#define MESH_FRAG_ACK_LEN           8       // 1 byte transfer id | 1 byte status | 2 byte next missing index | 4 byte bitmap
+#define MESH_FRAG_SIZE              128     // message bytes per fragment
+#define MESH_FRAG_MAX_MSG_LEN       4096    // largest large message, sets sender and receiver buffer size
+#define MESH_FRAG_TX_SLOTS          1       // large messages sent at once
+#define MESH_FRAG_RX_SLOTS          2       // large messages reassembled at once, more senders get told to retry later
+#define MESH_FRAG_WINDOW            4       // fragments in flight from the first unacked one (max 32), keep under MESH_TXQ_BULK_LEN
+#define MESH_FRAG_ACK_EVERY         2       // receiver acks every this many fragments, and right away on gap, duplicate or completion
+#define MESH_FRAG_TIMEOUT_US        3000000 // sender resends unacked fragments when acks make no progress for 3s
+#define MESH_FRAG_MAX_ATTEMPTS      5       // timeouts in a row before sender gives up
+#define MESH_FRAG_RESUME_DELAY_US   100000  // send queue full, sender continues after this
+#define MESH_FRAG_RX_TIMEOUT_US     30000000 // receiver buffer of a message idle this long can be reused
+
 #define timer_for_ping          120000000 //10,000,000 means 10 seconds for pinging root to check conectivity
 
+// standard mesh heartbeat in place of the ECS_193_MODEL_OP_CONNECTIVITY ping, set up by loop_message_connection()
+// through the node's own config client, needs CONFIG_BLE_MESH_CFG_CLI in sdkconfig
+#define MESH_HEARTBEAT                  DISABLE     // needs CONFIG_BLE_MESH_CFG_CLI=y in sdkconfig
+#define MESH_HEARTBEAT_PUB_PERIOD_LOG   0x08        // unacked heartbeat to root every 2^(n-1) s, 0x08 = 128s close to timer_for_ping
+#define MESH_HEARTBEAT_SUB_DST          0xFFFF      // root heartbeats to this address give the hop count to root, all nodes by default
+#define MESH_HEARTBEAT_SUB_PERIOD_LOG   0x11        // subscription lasts 2^(n-1) s, 0x11 = 65536s is the largest
+#define MESH_HEARTBEAT_SUB_RENEW_US     3600000000  // subscription set again every hour, well before it runs out
+#define MESH_HEARTBEAT_MISS_LIMIT       3           // root heartbeat periods missed before the connection timeout path runs
+
 #define COMP_DATA_PAGE_0    0x00
 
 #define COMP_DATA_1_OCTET(msg, offset)      (msg[offset])
@@ -56,6 +138,16 @@
 #define ECS_193_MODEL_OP_RESPONSE_I_0    ESP_BLE_MESH_MODEL_OP_3(0x0b, ECS_193_CID)
 #define ECS_193_MODEL_OP_RESPONSE_I_1    ESP_BLE_MESH_MODEL_OP_3(0x0c, ECS_193_CID)
 #define ECS_193_MODEL_OP_RESPONSE_I_2    ESP_BLE_MESH_MODEL_OP_3(0x0d, ECS_193_CID)
+#define ECS_193_MODEL_OP_MESSAGE_I      ESP_BLE_MESH_MODEL_OP_3(0x0e, ECS_193_CID) // 2 byte sequence | message
+#define ECS_193_MODEL_OP_ACK_I          ESP_BLE_MESH_MODEL_OP_3(0x0f, ECS_193_CID) // 2 byte sequence
+#define ECS_193_MODEL_OP_FRAG           ESP_BLE_MESH_MODEL_OP_3(0x10, ECS_193_CID) // fragment header | fragment
+#define ECS_193_MODEL_OP_FRAG_ACK       ESP_BLE_MESH_MODEL_OP_3(0x11, ECS_193_CID) // selective ack of fragments
+#define ECS_193_MODEL_OP_MESSAGE_IC     ESP_BLE_MESH_MODEL_OP_3(0x12, ECS_193_CID) // 2 byte sequence | 1 byte back | message
+#define ECS_193_MODEL_OP_ACK_C          ESP_BLE_MESH_MODEL_OP_3(0x13, ECS_193_CID) // 2 byte contiguous sequence | 4 byte bitmap
+
+// opcode registry - vendor model op tables are built from registered opcodes, received ones dispatched by 6 bit opcode
+#define MESH_OP_CODE_COUNT              64  // 3 byte vendor opcodes 0xC0-0xFF, ESP_BLE_MESH_MODEL_OP_3(0x00-0x3F, cid)
+#define MESH_OP_MAX_REGISTERED          32  // opcodes registered with mesh_register_opcode(), core ones included
 
 #define NVS_KEY_ROOT "ECS_193_client"
 
@@ -3,12 +3,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#include <errno.h>
 
 #include "board.h"
 #include "ble_mesh_config_edge.h"
 #include "../Secret/NetworkConfig.h"
 
 #include "esp_ble_mesh_local_data_operation_api.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 
 #if CONFIG_BLE_MESH_RPR_SRV
 #include "esp_ble_mesh_rpr_model_api.h"
@@ -23,10 +28,209 @@ esp_timer_handle_t periodic_timer;
 esp_timer_handle_t oneshot_timer;
 bool periodic_timer_start = false;
 
-// Variable stroing important message that require rtacking and retransmission
-static uint8_t** important_message_data_list = NULL;
-static uint16_t important_message_data_lengths[] = {0, 0, 0};
-static uint8_t important_message_retransmit_times[] = {0, 0, 0};
+// Important message (reliable delivery) tracking, payloads kept in a fixed pool until acked
+#if MESH_RELIABLE_CUMULATIVE_ACK
+#define RELIABLE_OPCODE     ECS_193_MODEL_OP_MESSAGE_IC
+#define RELIABLE_HDR_LEN    MESH_RELIABLE_CUM_HDR_LEN
+#else
+#define RELIABLE_OPCODE     ECS_193_MODEL_OP_MESSAGE_I
+#define RELIABLE_HDR_LEN    MESH_RELIABLE_HDR_LEN
+#endif
+#define RELIABLE_BACK_UNKNOWN   0xFF    // oldest unacked sequence too far back, receiver can't ack cumulatively past it
+
+typedef struct {
+    bool in_use;
+    uint16_t dst_address;
+    uint16_t seq;
+    uint16_t length;            // sequence header + message
+    uint8_t attempts;           // transmissions so far
+    int64_t next_tx_us;         // retransmit when no ack by this time
+    int64_t deadline_us;        // give up when no ack by this time
+    important_done_cb_t done_cb;
+    void *done_ctx;
+    uint8_t data[RELIABLE_HDR_LEN + MESH_RELIABLE_MAX_MSG_LEN];
+} reliable_slot_t;
+
+typedef struct {
+    uint16_t addr;              // 0 for unused entry
+    uint16_t next_seq;
+    uint8_t in_flight;
+} reliable_peer_t;
+
+static reliable_slot_t reliable_pool[MESH_RELIABLE_POOL_SIZE];
+static uint8_t reliable_free_slots[MESH_RELIABLE_POOL_SIZE]; // stack of free pool index
+static uint8_t reliable_free_count = 0;
+static reliable_peer_t reliable_peers[MESH_RELIABLE_MAX_PEERS];
+static SemaphoreHandle_t reliable_lock = NULL;
+static esp_timer_handle_t reliable_timer;
+
+// Receiver side of cumulative ack, per sending node
+typedef struct {
+    uint16_t addr;              // 0 for unused entry
+    uint16_t contiguous;        // every sequence up to this one received or given up on by sender
+    uint32_t bitmap;            // bit i set - sequence contiguous + 1 + i received
+    uint8_t pending;            // messages received since last ack
+    int64_t ack_due_us;         // delayed ack goes out at this time, INT64_MAX when nothing pending
+    int64_t last_rx_us;
+    uint16_t net_idx;           // to send the delayed ack
+    uint16_t app_idx;
+} cum_ack_peer_t;
+
+static cum_ack_peer_t cum_ack_peers[MESH_ACK_MAX_PEERS];
+static SemaphoreHandle_t cum_ack_lock = NULL;
+static esp_timer_handle_t cum_ack_timer;
+
+// Large message transfer, sender keeps a window of fragments in flight, receiver reassembles in a fixed buffer pool
+#define MESH_FRAG_MAX_COUNT ((MESH_FRAG_MAX_MSG_LEN + MESH_FRAG_SIZE - 1) / MESH_FRAG_SIZE)
+#define MESH_FRAG_STATUS_OK         0x00
+#define MESH_FRAG_STATUS_NO_BUFFER  0x01    // receiver pool full, sender retries on timeout
+#define MESH_FRAG_STATUS_TOO_LARGE  0x02    // message above receiver's MESH_FRAG_MAX_MSG_LEN, sender gives up
+
+typedef struct {
+    bool in_use;
+    uint16_t dst_address;
+    uint8_t transfer_id;
+    uint16_t length;
+    uint16_t frag_count;
+    uint16_t next_missing;      // every fragment below this acked
+    uint32_t acked_bitmap;      // bit i set - fragment next_missing + 1 + i acked
+    uint16_t next_new;          // first fragment not sent yet
+    uint16_t resent_below;      // holes below this already resent since last timeout
+    uint8_t attempts;           // timeouts in a row without ack progress
+    int64_t timeout_us;         // resend unacked fragments when no ack progress by this time
+    int64_t resume_us;          // send queue was full, continue sending at this time, INT64_MAX when not waiting
+    important_done_cb_t done_cb;
+    void *done_ctx;
+    uint8_t data[MESH_FRAG_MAX_MSG_LEN];
+} frag_tx_t;
+
+typedef struct {
+    bool in_use;
+    bool complete;              // delivered, kept to re-ack retransmits until the buffer is needed
+    uint16_t src_address;
+    uint8_t transfer_id;
+    uint16_t length;
+    uint16_t frag_count;
+    uint16_t next_missing;      // every fragment below this received
+    uint8_t unacked;            // fragments received since last ack
+    int64_t last_rx_us;
+    uint32_t received[(MESH_FRAG_MAX_COUNT + 31) / 32];
+    uint8_t data[MESH_FRAG_MAX_MSG_LEN];
+} frag_rx_t;
+
+static frag_tx_t frag_tx_pool[MESH_FRAG_TX_SLOTS];
+static frag_rx_t frag_rx_pool[MESH_FRAG_RX_SLOTS];
+static uint8_t frag_next_transfer_id = 0;
+static SemaphoreHandle_t frag_lock = NULL;
+static esp_timer_handle_t frag_timer;
+
+// Received important messages by source and sequence, set associative so lookup is constant time, only used in btc task
+typedef struct {
+    uint16_t src_address;       // 0 for unused entry
+    uint16_t seq;
+    int64_t expires_us;
+} mesh_dedup_entry_t;
+
+static mesh_dedup_entry_t mesh_dedup_cache[MESH_DEDUP_SETS][MESH_DEDUP_WAYS];
+static mesh_dedup_stats_t mesh_dedup_stats = {0};
+
+// Per destination hop distance learned from received messages, picks the send ttl
+typedef struct {
+    uint16_t addr;              // 0 for unused entry
+    uint8_t relays;             // largest relay count seen in current window
+    int64_t window_start_us;
+    int64_t last_rx_us;
+} mesh_ttl_peer_t;
+
+static mesh_ttl_peer_t mesh_ttl_peers[MESH_TTL_MAX_PEERS];
+static SemaphoreHandle_t mesh_ttl_lock = NULL;
+
+// heartbeats from root, updated in btc task, read from esp_timer and uart rx task, all under mesh_heartbeat_lock
+static mesh_heartbeat_stats_t mesh_heartbeat_stats = {0};
+static SemaphoreHandle_t mesh_heartbeat_lock = NULL;
+#if MESH_HEARTBEAT
+static bool mesh_heartbeat_started = false;
+// root publishes its heartbeat at the same period as ours
+#define MESH_HEARTBEAT_PERIOD_US    (1000000LL << (MESH_HEARTBEAT_PUB_PERIOD_LOG - 1))
+static int64_t mesh_heartbeat_start_us = 0;    // esp_timer task only
+static int64_t mesh_heartbeat_renew_us = 0;    // esp_timer task only
+#endif
+
+// Outstanding mesh_send_async() requests, matched by handle, response required ones by destination
+typedef struct {
+    mesh_send_handle_t handle;  // 0 for unused entry
+    mesh_delivery_class_t delivery_class;
+    uint16_t dst_address;
+    bool sent;                  // send complete seen, stack is waiting for the response
+    mesh_send_done_cb_t done_cb;
+    void *user_ctx;
+} mesh_req_t;
+
+static mesh_req_t mesh_reqs[MESH_REQ_POOL_SIZE];
+static mesh_send_handle_t mesh_req_next_handle = 1;
+static SemaphoreHandle_t mesh_req_lock = NULL;
+
+// Outbound send queue, one lane per priority, head entry stays queued until the stack reports send complete so it can be resubmitted
+typedef struct {
+    uint32_t opcode;
+    uint16_t dst_address;
+    uint8_t send_ttl;
+    bool need_rsp;
+    uint8_t retries;
+    mesh_send_handle_t req_handle;  // 0 when no mesh_send_async() request waits on it
+    uint16_t length;
+    uint8_t data[MESH_TXQ_MAX_MSG_LEN];
+} mesh_tx_entry_t;
+
+typedef enum {
+    MESH_TX_LANE_CONTROL,   // reset, connectivity ping, host flagged control messages
+    MESH_TX_LANE_RELIABLE,  // important and response required messages
+    MESH_TX_LANE_BULK,      // normal messages and broadcast, telemetry
+    MESH_TX_LANE_COUNT,
+} mesh_tx_lane_id_t;
+
+typedef struct {
+    mesh_tx_entry_t *entries;
+    uint8_t size;
+    uint8_t head;
+    uint8_t count;
+    uint8_t passed_over;    // times a higher lane was served while this one waited
+    TickType_t ready_at;    // head entry waits out its resubmit delay until then
+} mesh_tx_lane_t;
+
+static mesh_tx_entry_t mesh_tx_entries[MESH_TXQ_CONTROL_LEN + MESH_TXQ_RELIABLE_LEN + MESH_TXQ_BULK_LEN];
+static mesh_tx_lane_t mesh_tx_lanes[MESH_TX_LANE_COUNT] = {
+    [MESH_TX_LANE_CONTROL]  = {mesh_tx_entries, MESH_TXQ_CONTROL_LEN},
+    [MESH_TX_LANE_RELIABLE] = {mesh_tx_entries + MESH_TXQ_CONTROL_LEN, MESH_TXQ_RELIABLE_LEN},
+    [MESH_TX_LANE_BULK]     = {mesh_tx_entries + MESH_TXQ_CONTROL_LEN + MESH_TXQ_RELIABLE_LEN, MESH_TXQ_BULK_LEN},
+};
+static mesh_tx_lane_t *mesh_txq_active = NULL;  // lane whose head entry is handed to stack, waiting for send complete
+static bool mesh_txq_congested = false;         // any lane past high water until every lane drained to low water
+static bool mesh_txq_congested_reported = false; // last state given to backpressure_handler_cb, mesh_tx_task only
+static TickType_t mesh_txq_wait_until = 0;      // send complete timeout of the active lane's head entry
+static SemaphoreHandle_t mesh_txq_lock = NULL;
+static TaskHandle_t mesh_tx_task_handle = NULL;
+
+// Send that timed out waiting for its send complete event, the event only carries opcode and destination so a late one
+// would complete the next send to the same node, no send to it with the opcode goes out until the event drained or expired
+typedef struct {
+    uint32_t opcode;            // 0 for unused entry
+    uint16_t dst_address;
+    TickType_t expires;
+    mesh_send_handle_t req_handle;  // request kept open until the late event, MESH_SEND_UNKNOWN when it never comes
+} mesh_tx_stale_t;
+
+static mesh_tx_stale_t mesh_txq_stale[MESH_TXQ_STALE_SLOTS];
+
+// Destination of a response required send handed to the stack, the client model rejects the next one to it with -EBUSY
+// until the response or its client timeout event, so that one waits in its lane instead
+typedef struct {
+    uint16_t dst_address;       // 0 for unused entry
+    TickType_t expires;         // only reached when the stack's timeout event got lost
+} mesh_tx_rsp_wait_t;
+
+static mesh_tx_rsp_wait_t mesh_txq_rsp_wait[MESH_TXQ_RSP_SLOTS];
+static mesh_send_stats_t mesh_send_stats = {0};
 
 // =============== Node (Edge) Configuration ===============
 static uint8_t dev_uuid[ESP_BLE_MESH_OCTET16_LEN] = INIT_UUID_MATCH;
@@ -72,52 +276,52 @@ static esp_ble_mesh_cfg_srv_t config_server = {
     .relay_retransmit = ESP_BLE_MESH_TRANSMIT(2, 20),
 };
 
+#if MESH_HEARTBEAT
+#if !CONFIG_BLE_MESH_CFG_CLI
+#error "MESH_HEARTBEAT needs CONFIG_BLE_MESH_CFG_CLI=y in sdkconfig"
+#endif
+// only talks to the node's own config server, sets heartbeat publication and subscription
+static esp_ble_mesh_client_t config_client;
+#endif
+
 static esp_ble_mesh_model_t root_models[] = {
 #if CONFIG_BLE_MESH_RPR_SRV
     ESP_BLE_MESH_MODEL_RPR_SRV(NULL),
 #endif
     ESP_BLE_MESH_MODEL_CFG_SRV(&config_server),
+#if MESH_HEARTBEAT
+    ESP_BLE_MESH_MODEL_CFG_CLI(&config_client), // keep last, see mesh_heartbeat_config_set()
+#endif
 };
 
-static const esp_ble_mesh_client_op_pair_t client_op_pair[] = {
-    {ECS_193_MODEL_OP_MESSAGE, ECS_193_MODEL_OP_EMPTY},
-    {ECS_193_MODEL_OP_MESSAGE_R, ECS_193_MODEL_OP_RESPONSE},
-    {ECS_193_MODEL_OP_MESSAGE_I_0, ECS_193_MODEL_OP_RESPONSE_I_0},
-    {ECS_193_MODEL_OP_MESSAGE_I_1, ECS_193_MODEL_OP_RESPONSE_I_1},
-    {ECS_193_MODEL_OP_MESSAGE_I_2, ECS_193_MODEL_OP_RESPONSE_I_2},
-    {ECS_193_MODEL_OP_BROADCAST, ECS_193_MODEL_OP_EMPTY},
-    {ECS_193_MODEL_OP_CONNECTIVITY, ECS_193_MODEL_OP_RESPONSE},
-    {ECS_193_MODEL_OP_SET_TTL, ECS_193_MODEL_OP_EMPTY},
-};
+// generated from the opcode registry by mesh_op_build_tables(), zeroed entry ends an op table
+static esp_ble_mesh_client_op_pair_t client_op_pair[MESH_OP_MAX_REGISTERED];
 
 static esp_ble_mesh_client_t ecs_193_client = {
-    .op_pair_size = ARRAY_SIZE(client_op_pair),
+    .op_pair_size = 0,
     .op_pair = client_op_pair,
 };
 
-static esp_ble_mesh_model_op_t client_op[] = { // operation client will "RECEIVED"
-    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_RESPONSE, 1),
-    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_RESPONSE_I_0, 1),
-    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_RESPONSE_I_1, 1),
-    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_RESPONSE_I_2, 1),
-    ESP_BLE_MESH_MODEL_OP_END,
-};
+static esp_ble_mesh_model_op_t *client_op = NULL; // operation client will "RECEIVED"
+static esp_ble_mesh_model_op_t *server_op = NULL; // operation server will "RECEIVED"
 
-static esp_ble_mesh_model_op_t server_op[] = { // operation server will "RECEIVED"
-    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_MESSAGE, 1),
-    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_MESSAGE_R, 1),
-    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_MESSAGE_I_0, 1),
-    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_MESSAGE_I_1, 1),
-    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_MESSAGE_I_2, 1),
-    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_BROADCAST, 1),
-    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_CONNECTIVITY, 1),
-    ESP_BLE_MESH_MODEL_OP(ECS_193_MODEL_OP_SET_TTL, 1), // edge will recive set ttl from root
-    ESP_BLE_MESH_MODEL_OP_END,
-};
+// Registered ECS_193 opcodes, looked up by the 6 bit code of the vendor opcode
+typedef struct {
+    uint32_t opcode;
+    uint8_t directions;         // mesh_op_dir_t bits
+    uint16_t min_len;
+    mesh_op_handler_t handler;
+    uint32_t rsp_opcode;
+} mesh_op_entry_t;
+
+static mesh_op_entry_t mesh_op_entries[MESH_OP_MAX_REGISTERED];
+static uint8_t mesh_op_count = 0;
+static uint8_t mesh_op_index[MESH_OP_CODE_COUNT]; // entry index + 1, 0 for unregistered code
+static bool mesh_op_tables_built = false;
 
 static esp_ble_mesh_model_t vnd_models[] = { // custom models
-    ESP_BLE_MESH_VENDOR_MODEL(ECS_193_CID, ECS_193_MODEL_ID_CLIENT, client_op, NULL, &ecs_193_client), 
-    ESP_BLE_MESH_VENDOR_MODEL(ECS_193_CID, ECS_193_MODEL_ID_SERVER, server_op, NULL, NULL),
+    ESP_BLE_MESH_VENDOR_MODEL(ECS_193_CID, ECS_193_MODEL_ID_CLIENT, NULL, NULL, &ecs_193_client), // op set by mesh_op_build_tables()
+    ESP_BLE_MESH_VENDOR_MODEL(ECS_193_CID, ECS_193_MODEL_ID_SERVER, NULL, NULL, NULL),
 };
 
 static esp_ble_mesh_model_t *client_model = &vnd_models[0];
@@ -141,6 +345,13 @@ static void (*recv_response_handler_cb)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t le
 static void (*timeout_handler_cb)(esp_ble_mesh_msg_ctx_t *ctx, uint32_t opcode) = NULL;
 static void (*broadcast_handler_cb)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr) = NULL;
 static void (*connectivity_handler_cb)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr) = NULL;;
+static void (*important_failed_handler_cb)(uint16_t dst_address, uint16_t length, uint8_t *msg_ptr) = NULL;
+static void (*backpressure_handler_cb)(bool congested, uint16_t queued) = NULL;
+
+static void mesh_heartbeat_recv(uint8_t hops, uint16_t feature);
+#if MESH_HEARTBEAT
+static void mesh_heartbeat_range_reset();
+#endif
 
 // ====================== Edge Core Network Functions ======================
 static esp_err_t prov_complete(uint16_t net_idx, uint16_t addr, uint8_t flags, uint32_t iv_index)
@@ -183,6 +394,9 @@ static void ble_mesh_provisioning_cb(esp_ble_mesh_prov_cb_event_t event, esp_ble
     case ESP_BLE_MESH_NODE_SET_UNPROV_DEV_NAME_COMP_EVT:
         ESP_LOGI(TAG, "ESP_BLE_MESH_NODE_SET_UNPROV_DEV_NAME_COMP_EVT, err_code %d", param->node_set_unprov_dev_name_comp.err_code);
         break;
+    case ESP_BLE_MESH_HEARTBEAT_MESSAGE_RECV_EVT:
+        mesh_heartbeat_recv(param->heartbeat_msg_recv.hops, param->heartbeat_msg_recv.feature);
+        break;
     default:
         break;
     }
@@ -293,6 +507,15 @@ static void example_ble_mesh_config_server_cb(esp_ble_mesh_cfg_server_cb_event_t
                 param->value.state_change.mod_sub_add.sub_addr,
                 param->value.state_change.mod_sub_add.company_id,
                 param->value.state_change.mod_sub_add.model_id);
+            // applied by the stack, group messages to sub_addr now reach the model
+            break;
+        case ESP_BLE_MESH_MODEL_OP_MODEL_SUB_DELETE:
+            ESP_LOGI(TAG, "ESP_BLE_MESH_MODEL_OP_MODEL_SUB_DELETE");
+            ESP_LOGI(TAG, "elem_addr 0x%04x, sub_addr 0x%04x, cid 0x%04x, mod_id 0x%04x",
+                param->value.state_change.mod_sub_delete.element_addr,
+                param->value.state_change.mod_sub_delete.sub_addr,
+                param->value.state_change.mod_sub_delete.company_id,
+                param->value.state_change.mod_sub_delete.model_id);
             break;
         default:
             break;
@@ -300,57 +523,252 @@ static void example_ble_mesh_config_server_cb(esp_ble_mesh_cfg_server_cb_event_t
     }
 }
 
+#if MESH_HEARTBEAT
+static void ble_mesh_config_client_cb(esp_ble_mesh_cfg_client_cb_event_t event, esp_ble_mesh_cfg_client_cb_param_t *param)
+{
+    uint32_t opcode = param->params->opcode;
+
+    switch (event) {
+    case ESP_BLE_MESH_CFG_CLIENT_SET_STATE_EVT:
+        if (param->error_code != 0) {
+            ESP_LOGE(TAG, "Heartbeat config 0x%04" PRIx32 " failed, err_code %d", opcode, param->error_code);
+        } else if (opcode == ESP_BLE_MESH_MODEL_OP_HEARTBEAT_PUB_SET) {
+            ESP_LOGI(TAG, "Heartbeat publication to root set");
+        } else if (opcode == ESP_BLE_MESH_MODEL_OP_HEARTBEAT_SUB_SET) {
+            ESP_LOGI(TAG, "Heartbeat subscription to root set");
+            mesh_heartbeat_range_reset(); // stack restarted its hop count range as well
+        }
+        break;
+    case ESP_BLE_MESH_CFG_CLIENT_TIMEOUT_EVT:
+        ESP_LOGW(TAG, "Heartbeat config 0x%04" PRIx32 " timed out", opcode);
+        break;
+    default:
+        break;
+    }
+}
+#endif
+
+static void reliable_ack_received(uint16_t src_address, uint16_t seq);
+static void mesh_txq_send_complete(esp_ble_mesh_model_t *model, uint32_t opcode, uint16_t dst_address, int err_code);
+static void mesh_txq_rsp_done(uint16_t dst_address);
+static void reliable_send_ack(esp_ble_mesh_msg_ctx_t *ctx, uint16_t seq);
+static bool mesh_dedup_seen(uint16_t src_address, uint16_t seq);
+static void cum_ack_message_received(esp_ble_mesh_msg_ctx_t *ctx, uint16_t seq, uint8_t back);
+static void reliable_cum_ack_received(uint16_t src_address, uint16_t contiguous, uint32_t bitmap);
+static void mesh_ttl_learn(uint16_t src_address, uint8_t recv_ttl);
+static void mesh_ttl_learn_relays(uint16_t src_address, uint8_t relays);
+static uint8_t mesh_ttl_for(uint16_t dst_address);
+static void frag_received(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg);
+static void frag_ack_received(uint16_t src_address, uint8_t *ack);
+static void mesh_req_response(uint16_t dst_address, mesh_send_status_t status, uint16_t length, uint8_t *msg_ptr);
+
+// ====== ECS_193 opcode registry, op tables generated from it and received messages dispatched through it ======
+// 3 byte vendor opcode of our company id, caller checks before indexing with MESH_OP_CODE()
+#define MESH_OP_IS_ECS_193(opcode)  (((opcode) & 0xFFC0FFFF) == (0xC00000 | ECS_193_CID))
+#define MESH_OP_CODE(opcode)        (((opcode) >> 16) & 0x3F)
+
+static const mesh_op_entry_t* mesh_op_lookup(uint32_t opcode) {
+    if (!MESH_OP_IS_ECS_193(opcode) || mesh_op_index[MESH_OP_CODE(opcode)] == 0) {
+        return NULL;
+    }
+    return &mesh_op_entries[mesh_op_index[MESH_OP_CODE(opcode)] - 1];
+}
+
+static void mesh_op_message(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode) {
+    recv_message_handler_cb(ctx, length, msg_ptr, opcode);
+}
+
+static void mesh_op_important(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode) {
+    // ack first, sender retransmits until it sees the ack, retransmit after a lost ack is acked again only
+    uint16_t seq = (msg_ptr[0] << 8) | msg_ptr[1];
+    reliable_send_ack(ctx, seq);
+    if (mesh_dedup_seen(ctx->addr, seq)) {
+        return;
+    }
+    recv_message_handler_cb(ctx, length - MESH_RELIABLE_HDR_LEN, msg_ptr + MESH_RELIABLE_HDR_LEN, opcode);
+}
+
+static void mesh_op_important_cum(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode) {
+    // acked together with others from the same node, duplicate is acked again right away
+    uint16_t seq = (msg_ptr[0] << 8) | msg_ptr[1];
+    cum_ack_message_received(ctx, seq, msg_ptr[2]);
+    if (mesh_dedup_seen(ctx->addr, seq)) {
+        return;
+    }
+    recv_message_handler_cb(ctx, length - MESH_RELIABLE_CUM_HDR_LEN, msg_ptr + MESH_RELIABLE_CUM_HDR_LEN, opcode);
+}
+
+static void mesh_op_ack_cum(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode) {
+    uint32_t bitmap = ((uint32_t) msg_ptr[2] << 24) | ((uint32_t) msg_ptr[3] << 16) | ((uint32_t) msg_ptr[4] << 8) | msg_ptr[5];
+    reliable_cum_ack_received(ctx->addr, (msg_ptr[0] << 8) | msg_ptr[1], bitmap);
+    recv_response_handler_cb(ctx, length, msg_ptr, opcode);
+}
+
+static void mesh_op_response(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode) {
+    mesh_txq_rsp_done(ctx->addr);
+    mesh_req_response(ctx->addr, MESH_SEND_ACKED, length, msg_ptr);
+    recv_response_handler_cb(ctx, length, msg_ptr, opcode);
+}
+
+static void mesh_op_ack(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode) {
+    reliable_ack_received(ctx->addr, (msg_ptr[0] << 8) | msg_ptr[1]);
+    recv_response_handler_cb(ctx, length, msg_ptr, opcode);
+}
+
+static void mesh_op_frag(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode) {
+    // reassembled message goes to recv_message_handler_cb once complete
+    frag_received(ctx, length, msg_ptr);
+}
+
+static void mesh_op_frag_ack(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode) {
+    frag_ack_received(ctx->addr, msg_ptr);
+}
+
+static void mesh_op_broadcast(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode) {
+    broadcast_handler_cb(ctx, length, msg_ptr);
+}
+
+static void mesh_op_connectivity(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode) {
+    connectivity_handler_cb(ctx, length, msg_ptr);
+}
+
+static void mesh_op_set_ttl(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode) {
+    set_message_ttl(msg_ptr[0]);
+}
+
+// opcodes the network module itself handles, registered ahead of application ones
+static const mesh_op_entry_t mesh_op_core[] = {
+    {ECS_193_MODEL_OP_MESSAGE,      MESH_OP_SERVER_RX | MESH_OP_CLIENT_TX, 1, mesh_op_message, ECS_193_MODEL_OP_EMPTY},
+    {ECS_193_MODEL_OP_MESSAGE_R,    MESH_OP_SERVER_RX | MESH_OP_CLIENT_TX, 1, mesh_op_message, ECS_193_MODEL_OP_RESPONSE},
+    {ECS_193_MODEL_OP_MESSAGE_I_0,  MESH_OP_SERVER_RX, 1, mesh_op_message, 0},
+    {ECS_193_MODEL_OP_MESSAGE_I_1,  MESH_OP_SERVER_RX, 1, mesh_op_message, 0},
+    {ECS_193_MODEL_OP_MESSAGE_I_2,  MESH_OP_SERVER_RX, 1, mesh_op_message, 0}, // older peers' important message
+    {ECS_193_MODEL_OP_MESSAGE_I,    MESH_OP_SERVER_RX, MESH_RELIABLE_HDR_LEN, mesh_op_important, 0},
+    {ECS_193_MODEL_OP_ACK_I,        MESH_OP_SERVER_RX, MESH_RELIABLE_HDR_LEN, mesh_op_ack, 0}, // ack to our important message
+    {ECS_193_MODEL_OP_MESSAGE_IC,   MESH_OP_SERVER_RX, MESH_RELIABLE_CUM_HDR_LEN, mesh_op_important_cum, 0},
+    {ECS_193_MODEL_OP_ACK_C,        MESH_OP_SERVER_RX, MESH_ACK_C_LEN, mesh_op_ack_cum, 0}, // cumulative ack to our important messages
+    {ECS_193_MODEL_OP_FRAG,         MESH_OP_SERVER_RX, MESH_FRAG_HDR_LEN + 1, mesh_op_frag, 0},
+    {ECS_193_MODEL_OP_FRAG_ACK,     MESH_OP_SERVER_RX, MESH_FRAG_ACK_LEN, mesh_op_frag_ack, 0}, // ack to our large message fragments
+    {ECS_193_MODEL_OP_BROADCAST,    MESH_OP_SERVER_RX | MESH_OP_CLIENT_TX, 1, mesh_op_broadcast, ECS_193_MODEL_OP_EMPTY},
+    {ECS_193_MODEL_OP_CONNECTIVITY, MESH_OP_SERVER_RX | MESH_OP_CLIENT_TX, 1, mesh_op_connectivity, ECS_193_MODEL_OP_RESPONSE},
+    {ECS_193_MODEL_OP_SET_TTL,      MESH_OP_SERVER_RX | MESH_OP_CLIENT_TX, 1, mesh_op_set_ttl, ECS_193_MODEL_OP_EMPTY}, // edge will recive set ttl from root
+    {ECS_193_MODEL_OP_RESPONSE,     MESH_OP_CLIENT_RX, 1, mesh_op_response, 0},
+};
+
+static esp_err_t mesh_op_add(const mesh_op_entry_t *entry) {
+    if (!MESH_OP_IS_ECS_193(entry->opcode)) {
+        ESP_LOGE(TAG, "Opcode 0x%06" PRIx32 " is not an ECS_193 vendor opcode", entry->opcode);
+        return ESP_ERR_INVALID_ARG;
+    } else if (mesh_op_index[MESH_OP_CODE(entry->opcode)] != 0) {
+        ESP_LOGE(TAG, "Opcode 0x%06" PRIx32 " already registered", entry->opcode);
+        return ESP_ERR_INVALID_ARG;
+    } else if (mesh_op_count >= MESH_OP_MAX_REGISTERED) {
+        ESP_LOGE(TAG, "Opcode 0x%06" PRIx32 " exceeds MESH_OP_MAX_REGISTERED-%d", entry->opcode, MESH_OP_MAX_REGISTERED);
+        return ESP_ERR_NO_MEM;
+    }
+
+    mesh_op_entries[mesh_op_count] = *entry;
+    mesh_op_count += 1;
+    mesh_op_index[MESH_OP_CODE(entry->opcode)] = mesh_op_count;
+    return ESP_OK;
+}
+
+// core opcodes go in first, on the first application registration or at init
+static void mesh_op_register_core() {
+    if (mesh_op_count > 0) {
+        return;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(mesh_op_core); i++) {
+        ESP_ERROR_CHECK(mesh_op_add(&mesh_op_core[i]));
+    }
+}
+
+esp_err_t mesh_register_opcode(uint32_t opcode, uint8_t directions, uint16_t min_len, mesh_op_handler_t handler, uint32_t rsp_opcode) {
+    if (mesh_op_tables_built) {
+        ESP_LOGE(TAG, "Opcode 0x%06" PRIx32 " registered after mesh stack started", opcode);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    mesh_op_register_core();
+    mesh_op_entry_t entry = {opcode, directions, min_len, handler, rsp_opcode};
+    return mesh_op_add(&entry);
+}
+
+// op table of the registered opcodes received in direction, entries have const fields so it's built on the heap
+static esp_ble_mesh_model_op_t* mesh_op_alloc_table(uint8_t direction) {
+    uint8_t count = 0;
+    for (int i = 0; i < mesh_op_count; i++) {
+        count += (mesh_op_entries[i].directions & direction) != 0;
+    }
+
+    // zeroed entry past the last one is ESP_BLE_MESH_MODEL_OP_END
+    esp_ble_mesh_model_op_t *table = calloc(count + 1, sizeof(esp_ble_mesh_model_op_t));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    esp_ble_mesh_model_op_t *table_itr = table;
+    for (int i = 0; i < mesh_op_count; i++) {
+        const mesh_op_entry_t *entry = &mesh_op_entries[i];
+        if (entry->directions & direction) {
+            esp_ble_mesh_model_op_t op = ESP_BLE_MESH_MODEL_OP(entry->opcode, entry->min_len);
+            memcpy(table_itr++, &op, sizeof(op));
+        }
+    }
+    return table;
+}
+
+// vendor model op tables and client response pairs from the registry, before the stack takes them
+static esp_err_t mesh_op_build_tables() {
+    uint8_t pair_count = 0;
+
+    mesh_op_register_core();
+    if (!mesh_op_tables_built) {
+        server_op = mesh_op_alloc_table(MESH_OP_SERVER_RX);
+        client_op = mesh_op_alloc_table(MESH_OP_CLIENT_RX);
+        if (server_op == NULL || client_op == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    for (int i = 0; i < mesh_op_count; i++) {
+        const mesh_op_entry_t *entry = &mesh_op_entries[i];
+        if (entry->directions & MESH_OP_CLIENT_TX) {
+            client_op_pair[pair_count].cli_op = entry->opcode;
+            client_op_pair[pair_count].status_op = entry->rsp_opcode != 0 ? entry->rsp_opcode : ECS_193_MODEL_OP_EMPTY;
+            pair_count += 1;
+        }
+    }
+
+    client_model->op = client_op;
+    server_model->op = server_op;
+    ecs_193_client.op_pair_size = pair_count;
+    mesh_op_tables_built = true;
+    ESP_LOGI(TAG, "Opcode registry: %d opcodes, %d paired for client sends", mesh_op_count, pair_count);
+    return ESP_OK;
+}
+
 // Custom Model callback logic
 static void ble_mesh_custom_model_cb(esp_ble_mesh_model_cb_event_t event, esp_ble_mesh_model_cb_param_t *param)
 {
     // static int64_t start_time;
 
     switch (event) {
-    case ESP_BLE_MESH_MODEL_OPERATION_EVT:
-        switch (param->model_operation.opcode) {
-            case ECS_193_MODEL_OP_MESSAGE:
-            case ECS_193_MODEL_OP_MESSAGE_R:
-            case ECS_193_MODEL_OP_MESSAGE_I_0:
-            case ECS_193_MODEL_OP_MESSAGE_I_1:
-            case ECS_193_MODEL_OP_MESSAGE_I_2:
-                recv_message_handler_cb(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg, param->model_operation.opcode);
-                break;
-
-            case ECS_193_MODEL_OP_RESPONSE:
-            case ECS_193_MODEL_OP_RESPONSE_I_0:
-            case ECS_193_MODEL_OP_RESPONSE_I_1:
-            case ECS_193_MODEL_OP_RESPONSE_I_2:
-                recv_response_handler_cb(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg, param->model_operation.opcode);
-                break;
-            
-            default:
-                break;
-        }     
-
-        if (param->model_operation.opcode == ECS_193_MODEL_OP_BROADCAST) {
-            broadcast_handler_cb(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg);
-        } else if (param->model_operation.opcode == ECS_193_MODEL_OP_CONNECTIVITY) {
-            connectivity_handler_cb(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg);
-        } else if (param->model_operation.opcode == ECS_193_MODEL_OP_SET_TTL) {
-            uint8_t new_ttl = 0;
-            if (param->model_operation.length < 1) {
-                ESP_LOGW(TAG, "Set ttl message too short length:%d", param->model_operation.length);
-                return; 
-            }
-            
-            new_ttl = param->model_operation.msg[0];
-            set_message_ttl(new_ttl);
+    case ESP_BLE_MESH_MODEL_OPERATION_EVT: {
+        mesh_ttl_learn(param->model_operation.ctx->addr, param->model_operation.ctx->recv_ttl);
+        const mesh_op_entry_t *entry = mesh_op_lookup(param->model_operation.opcode);
+        if (entry != NULL && entry->handler != NULL) {
+            entry->handler(param->model_operation.ctx, param->model_operation.length, param->model_operation.msg, param->model_operation.opcode);
         }
-        
         break;
+    }
     case ESP_BLE_MESH_MODEL_SEND_COMP_EVT:
+        mesh_txq_send_complete(param->model_send_comp.model, param->model_send_comp.opcode,
+            param->model_send_comp.ctx->addr, param->model_send_comp.err_code);
         if (param->model_send_comp.err_code) {
+            // failed important message stays in the pool, it is retransmitted when its ack doesn't arrive
             ESP_LOGE(TAG, "Failed to send message 0x%06" PRIx32, param->model_send_comp.opcode);
-            int8_t index = get_important_message_index(param->model_send_comp.opcode);
-            if (index != -1) {
-                ESP_LOGE(TAG, "opcode 0x%06" PRIx32 " is \'important message\', clearing failed important message", param->model_send_comp.opcode);
-                clear_important_message(index);
-            }
             break;
         }
         // start_time = esp_timer_get_time();
@@ -363,6 +781,8 @@ static void ble_mesh_custom_model_cb(esp_ble_mesh_model_cb_event_t event, esp_bl
         break;
     case ESP_BLE_MESH_CLIENT_MODEL_SEND_TIMEOUT_EVT:
         ESP_LOGW(TAG, "Client message 0x%06" PRIx32 " timeout", param->client_send_timeout.opcode);
+        mesh_txq_rsp_done(param->client_send_timeout.ctx->addr);
+        mesh_req_response(param->client_send_timeout.ctx->addr, MESH_SEND_TIMEOUT, 0, NULL);
         timeout_handler_cb(param->client_send_timeout.ctx, param->client_send_timeout.opcode);
         break;
     default:
@@ -490,262 +910,2002 @@ static void example_remote_prov_server_callback(esp_ble_mesh_rpr_server_cb_event
     }
 }
 
+#if MESH_HEARTBEAT
+static esp_err_t mesh_heartbeat_pub_set();
+#endif
+
 // ===================== EDGE Network Utility Functions (APIs) =====================
 void set_message_ttl(uint8_t new_ttl) {
     ESP_LOGW(TAG, " === Updated message ttl on edge %d ===", new_ttl);
     ble_message_ttl = new_ttl;
-}
-
-void send_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response)
-{
-    esp_ble_mesh_msg_ctx_t ctx = {0};
-    uint32_t opcode = ECS_193_MODEL_OP_MESSAGE;
-    esp_ble_mesh_dev_role_t message_role = MSG_ROLE;
-    esp_err_t err = ESP_OK;
 
-    // ESP_LOGW(TAG, "net_idx: %" PRIu16, ble_mesh_key.net_idx);
-    // ESP_LOGW(TAG, "app_idx: %" PRIu16, ble_mesh_key.app_idx);
-    // ESP_LOGW(TAG, "dst_address: %" PRIu16, dst_address);
+    // learned hop counts assumed the old ttl on the sender side
+    if (mesh_ttl_lock != NULL) {
+        xSemaphoreTake(mesh_ttl_lock, portMAX_DELAY);
+        memset(mesh_ttl_peers, 0, sizeof(mesh_ttl_peers));
+        xSemaphoreGive(mesh_ttl_lock);
+    }
 
-    ctx.net_idx = ble_mesh_key.net_idx;
-    ctx.app_idx = ble_mesh_key.app_idx;
-    ctx.addr = dst_address;
-    ctx.send_ttl = ble_message_ttl;
-    
-    if (require_response) {
-        opcode = ECS_193_MODEL_OP_MESSAGE_R;
+#if MESH_HEARTBEAT
+    // heartbeats to root go as far as the messages do
+    if (mesh_heartbeat_started) {
+        mesh_heartbeat_pub_set();
     }
+#endif
+}
 
-    setNodeState(WORKING);
-    err = esp_ble_mesh_client_model_send_msg(client_model, &ctx, opcode, length, data_ptr, MSG_TIMEOUT, require_response, message_role);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to send message to node addr 0x%04x, err_code %d", dst_address, err);
+// ====== adaptive ttl, per destination ttl from the hop distance seen on its messages ======
+// peers send with the network wide ble_message_ttl, every relay on the way took 1 off recv_ttl, runs in btc task
+static void mesh_ttl_learn(uint16_t src_address, uint8_t recv_ttl) {
+    // retransmits sent with a raised ttl give a low estimate, the largest one in the window is kept
+    mesh_ttl_learn_relays(src_address, ble_message_ttl > recv_ttl ? ble_message_ttl - recv_ttl : 0);
+}
+
+// relay count from a received message or a heartbeat hop count
+static void mesh_ttl_learn_relays(uint16_t src_address, uint8_t relays) {
+#if MESH_TTL_ADAPTIVE
+    if (mesh_ttl_lock == NULL || !ESP_BLE_MESH_ADDR_IS_UNICAST(src_address)) {
         return;
     }
-    
-}
 
-void send_important_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr) {
-    int index = -1;
-    
-    for (int i=0; i<3; i++) {
-        if (important_message_data_list[i] == NULL) {
-            index = i;
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(mesh_ttl_lock, portMAX_DELAY);
+    mesh_ttl_peer_t *peer = NULL;
+    mesh_ttl_peer_t *oldest = &mesh_ttl_peers[0];
+    for (int i = 0; i < MESH_TTL_MAX_PEERS; i++) {
+        if (mesh_ttl_peers[i].addr == src_address) {
+            peer = &mesh_ttl_peers[i];
             break;
+        } else if (mesh_ttl_peers[i].last_rx_us < oldest->last_rx_us) {
+            oldest = &mesh_ttl_peers[i];
         }
     }
 
-    if (index == -1) {
-        ESP_LOGW(TAG, "Too many on tracking important message, failed to add one more");
-        return;
+    if (peer == NULL) {
+        peer = oldest;
+        peer->addr = src_address;
+        peer->relays = relays;
+        peer->window_start_us = now;
+        ESP_LOGI(TAG, "Node addr 0x%04x is %d relays away", src_address, relays);
+    } else if (now - peer->window_start_us >= MESH_TTL_WINDOW_US || now - peer->last_rx_us >= MESH_TTL_EXPIRE_US) {
+        if (peer->relays != relays) {
+            ESP_LOGI(TAG, "Node addr 0x%04x moved from %d to %d relays away", src_address, peer->relays, relays);
+        }
+        peer->relays = relays;
+        peer->window_start_us = now;
+    } else if (relays > peer->relays) {
+        peer->relays = relays;
     }
+    peer->last_rx_us = now;
+    xSemaphoreGive(mesh_ttl_lock);
+#endif
+}
 
-    // send message
-    esp_ble_mesh_msg_ctx_t ctx = {0};
-    uint32_t opcode = ECS_193_MODEL_OP_MESSAGE;
-    esp_ble_mesh_dev_role_t message_role = MSG_ROLE;
-    esp_err_t err = ESP_OK;
+// smallest ttl that covers the learned relays plus margin, global ttl when never or not recently heard from
+static uint8_t mesh_ttl_for(uint16_t dst_address) {
+    uint8_t send_ttl = ble_message_ttl;
 
-    ctx.net_idx = ble_mesh_key.net_idx;
-    ctx.app_idx = ble_mesh_key.app_idx;
-    ctx.addr = dst_address;
-    ctx.send_ttl = ble_message_ttl;
-    
-    if (index == 0) {
-        opcode = ECS_193_MODEL_OP_MESSAGE_I_0;
-    } else if (index == 1) {
-        opcode = ECS_193_MODEL_OP_MESSAGE_I_1;
-    } else if (index == 2) {
-        opcode = ECS_193_MODEL_OP_MESSAGE_I_2;
-    } else {
-        ESP_LOGW(TAG, "Error Index: [%d] for important messasge", index);
-        return;
+#if MESH_TTL_ADAPTIVE
+    if (mesh_ttl_lock == NULL) {
+        return send_ttl;
     }
 
-    // save the important message incase of need for resend
-    important_message_data_list[index] = (uint8_t*) malloc(length * sizeof(uint8_t));
-    important_message_data_lengths[index] = length;
-    important_message_retransmit_times[index] = 0;
-    
-    if (important_message_data_list[index] == NULL) {
-        ESP_LOGW(TAG, "Failed to allocate [%d] bytes for important messasge", length);
-        return;
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(mesh_ttl_lock, portMAX_DELAY);
+    for (int i = 0; i < MESH_TTL_MAX_PEERS; i++) {
+        mesh_ttl_peer_t *peer = &mesh_ttl_peers[i];
+        if (peer->addr == dst_address && now - peer->last_rx_us < MESH_TTL_EXPIRE_US) {
+            uint8_t learned_ttl = peer->relays + 1 + MESH_TTL_MARGIN;
+            send_ttl = learned_ttl < ble_message_ttl ? learned_ttl : ble_message_ttl;
+            break;
+        }
     }
-    memcpy(important_message_data_list[index], data_ptr, length);
+    xSemaphoreGive(mesh_ttl_lock);
+#endif
 
-    setNodeState(WORKING);
-    ESP_LOGE(TAG, "Sending important message, ttl: %d", ctx.send_ttl);
-    err = esp_ble_mesh_client_model_send_msg(client_model, &ctx, opcode, 
-        important_message_data_lengths[index], important_message_data_list[index], 
-        MSG_TIMEOUT, true, message_role);
-    
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to send important message to node addr 0x%04x, err_code %d", dst_address, err);
-        clear_important_message(index);
-        return;
-    }
+    return send_ttl;
 }
 
-int8_t get_important_message_index(uint32_t opcode) {
-    int8_t index = -1;
-    if (opcode == ECS_193_MODEL_OP_MESSAGE_I_0) {
-        index = 0;
-    } else if (opcode == ECS_193_MODEL_OP_MESSAGE_I_1) {
-        index = 1;
-    } else if (opcode == ECS_193_MODEL_OP_MESSAGE_I_2) {
-        index = 2;
+static esp_err_t mesh_ttl_init() {
+    if (mesh_ttl_lock == NULL) {
+        mesh_ttl_lock = xSemaphoreCreateMutex();
     }
-    else if (opcode == ECS_193_MODEL_OP_RESPONSE_I_0) {
-        index = 0;
-    } else if (opcode == ECS_193_MODEL_OP_RESPONSE_I_1) {
-        index = 1;
-    } else if (opcode == ECS_193_MODEL_OP_RESPONSE_I_2) {
-        index = 2;
+    if (mesh_heartbeat_lock == NULL) {
+        mesh_heartbeat_lock = xSemaphoreCreateMutex();
+    }
+    return mesh_ttl_lock == NULL || mesh_heartbeat_lock == NULL ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+// ====== async send requests, per request completion callback for mesh_send_async() ======
+static mesh_send_handle_t mesh_req_alloc(mesh_delivery_class_t delivery_class, uint16_t dst_address, mesh_send_done_cb_t done_cb, void *user_ctx) {
+    mesh_send_handle_t handle = 0;
+
+    xSemaphoreTake(mesh_req_lock, portMAX_DELAY);
+    for (int i = 0; i < MESH_REQ_POOL_SIZE; i++) {
+        mesh_req_t *req = &mesh_reqs[i];
+        if (req->handle != 0) {
+            continue;
+        }
+
+        handle = mesh_req_next_handle++;
+        if (mesh_req_next_handle == 0) {
+            mesh_req_next_handle = 1;
+        }
+        req->handle = handle;
+        req->delivery_class = delivery_class;
+        req->dst_address = dst_address;
+        req->sent = false;
+        req->done_cb = done_cb;
+        req->user_ctx = user_ctx;
+        break;
     }
+    xSemaphoreGive(mesh_req_lock);
 
-    return index;
+    return handle;
 }
 
-void retransmit_important_message(esp_ble_mesh_msg_ctx_t* ctx_ptr, uint32_t opcode, int8_t index) {
-    important_message_retransmit_times[index] += 1; // increment retransmit times count
+// report on request, frees it unless more is coming, caller holds mesh_req_lock and it is given back before the
+// callback so the callback can send again
+static void mesh_req_report(mesh_req_t *req, mesh_send_status_t status, int err_code, uint16_t length, uint8_t *msg_ptr) {
+    bool waits_reply = req->delivery_class == MESH_DELIVERY_RESPONSE || req->delivery_class == MESH_DELIVERY_IMPORTANT;
+    mesh_send_result_t result = {
+        .handle = req->handle,
+        .status = status,
+        .dst_address = req->dst_address,
+        .err_code = err_code,
+        .length = length,
+        .msg_ptr = msg_ptr,
+    };
+    mesh_send_done_cb_t done_cb = req->done_cb;
+    void *user_ctx = req->user_ctx;
+
+    if (status == MESH_SEND_SENT && waits_reply) {
+        req->sent = true;
+    } else {
+        req->handle = 0;
+    }
+    xSemaphoreGive(mesh_req_lock);
 
-    if (important_message_retransmit_times[index] > 3) {
-        ESP_LOGW(TAG, "Error Index: [%d] for retransmiting important messasge", index);
+    if (done_cb != NULL) {
+        done_cb(&result, user_ctx);
     }
+}
 
-    // retransmit message
-    setNodeState(WORKING);
-    uint8_t tll_increment = important_message_retransmit_times[index] / 2; // add 1 more ttl per 2 times retransmit to limit ttl
-    ctx_ptr->send_ttl = ble_message_ttl + tll_increment;
+// send complete or failure of the message carrying handle
+static void mesh_req_send_complete(mesh_send_handle_t handle, int err_code) {
+    if (handle == 0) {
+        return;
+    }
 
-    esp_err_t err = ESP_OK;
-    err = esp_ble_mesh_client_model_send_msg(client_model, ctx_ptr, opcode, 
-        important_message_data_lengths[index], important_message_data_list[index], 
-        MSG_TIMEOUT, true, MSG_ROLE);
-    
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to retransmit important message to node addr 0x%04x, err_code %d", ctx_ptr->addr, err);
-        ESP_LOGI(TAG, "clearing important_message, index: %d", index);
-        clear_important_message(index);
+    xSemaphoreTake(mesh_req_lock, portMAX_DELAY);
+    for (int i = 0; i < MESH_REQ_POOL_SIZE; i++) {
+        mesh_req_t *req = &mesh_reqs[i];
+        if (req->handle != handle) {
+            continue;
+        } else if (err_code != 0 && req->delivery_class == MESH_DELIVERY_IMPORTANT) {
+            break; // retransmitted, outcome comes with the ack or give up
+        }
+        mesh_req_report(req, err_code == 0 ? MESH_SEND_SENT : MESH_SEND_FAILED, err_code, 0, NULL);
         return;
     }
+    xSemaphoreGive(mesh_req_lock);
 }
 
-void clear_important_message(int8_t index) {
-    if (index < 0 || index > 2) {
-        ESP_LOGE(TAG, "Invaild index recived in clear_important_message(), index: %d", index);
+// send complete event of the message carrying handle never came, important messages still get their ack or give up
+static void mesh_req_send_unknown(mesh_send_handle_t handle) {
+    if (handle == 0) {
         return;
-    } else if (important_message_data_list[index] == NULL) {
-        ESP_LOGE(TAG, "Clearning an unused important message slot, index: %d", index);
+    }
+
+    xSemaphoreTake(mesh_req_lock, portMAX_DELAY);
+    for (int i = 0; i < MESH_REQ_POOL_SIZE; i++) {
+        mesh_req_t *req = &mesh_reqs[i];
+        if (req->handle != handle) {
+            continue;
+        } else if (req->delivery_class == MESH_DELIVERY_IMPORTANT) {
+            break;
+        }
+        mesh_req_report(req, MESH_SEND_UNKNOWN, ESP_ERR_TIMEOUT, 0, NULL);
         return;
     }
+    xSemaphoreGive(mesh_req_lock);
+}
+
+// response or stack timeout from dst, stack allows one response required message in flight per destination so the
+// sent request to it is the one
+static void mesh_req_response(uint16_t dst_address, mesh_send_status_t status, uint16_t length, uint8_t *msg_ptr) {
+    xSemaphoreTake(mesh_req_lock, portMAX_DELAY);
+    for (int i = 0; i < MESH_REQ_POOL_SIZE; i++) {
+        mesh_req_t *req = &mesh_reqs[i];
+        if (req->handle != 0 && req->sent && req->delivery_class == MESH_DELIVERY_RESPONSE && req->dst_address == dst_address) {
+            mesh_req_report(req, status, 0, length, msg_ptr);
+            return;
+        }
+    }
+    xSemaphoreGive(mesh_req_lock);
+}
 
-    free(important_message_data_list[index]);
+// important_done_cb_t of important messages sent with mesh_send_async(), done_ctx holds the handle
+static void mesh_req_important_done(void *done_ctx, uint16_t dst_address, bool acked) {
+    mesh_send_handle_t handle = (mesh_send_handle_t) (uintptr_t) done_ctx;
 
-    important_message_data_list[index] = NULL;
-    important_message_data_lengths[index] = 0;
-    important_message_retransmit_times[index] = 0;
-    ESP_LOGI(TAG, "Important_message slot cleared, index: %d", index);
+    xSemaphoreTake(mesh_req_lock, portMAX_DELAY);
+    for (int i = 0; i < MESH_REQ_POOL_SIZE; i++) {
+        mesh_req_t *req = &mesh_reqs[i];
+        if (req->handle == handle) {
+            mesh_req_report(req, acked ? MESH_SEND_ACKED : MESH_SEND_TIMEOUT, 0, 0, NULL);
+            return;
+        }
+    }
+    xSemaphoreGive(mesh_req_lock);
 }
 
-void broadcast_message(uint16_t length, uint8_t *data_ptr)
-{
-    esp_ble_mesh_msg_ctx_t ctx = {0};
-    uint32_t opcode = ECS_193_MODEL_OP_BROADCAST;
-    esp_ble_mesh_dev_role_t message_role = MSG_ROLE;
-    esp_err_t err = ESP_OK;
+static void mesh_req_free(mesh_send_handle_t handle) {
+    xSemaphoreTake(mesh_req_lock, portMAX_DELAY);
+    for (int i = 0; i < MESH_REQ_POOL_SIZE; i++) {
+        if (mesh_reqs[i].handle == handle) {
+            mesh_reqs[i].handle = 0;
+            break;
+        }
+    }
+    xSemaphoreGive(mesh_req_lock);
+}
 
-    // ESP_LOGW(TAG, "net_idx: %" PRIu16, ble_mesh_key.net_idx);
-    // ESP_LOGW(TAG, "app_idx: %" PRIu16, ble_mesh_key.app_idx);
-    // ESP_LOGW(TAG, "dst_address: %" PRIu16, dst_address);
+esp_err_t mesh_send_detach(mesh_send_handle_t handle) {
+    esp_err_t err = ESP_ERR_NOT_FOUND;
 
-    ctx.net_idx = ble_mesh_key.net_idx;
-    ctx.app_idx = ble_mesh_key.app_idx;
-    ctx.addr = 0xFFFF;
-    ctx.send_ttl = ble_message_ttl;
-    
+    if (mesh_req_lock == NULL || handle == 0) {
+        return err;
+    }
 
-    err = esp_ble_mesh_client_model_send_msg(client_model, &ctx, opcode, length, data_ptr, MSG_TIMEOUT, false, message_role);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to send message to node addr 0xFFFF, err_code %d", err);
-        return;
+    // entry stays until the outcome so later reports still find it, just nobody is told
+    xSemaphoreTake(mesh_req_lock, portMAX_DELAY);
+    for (int i = 0; i < MESH_REQ_POOL_SIZE; i++) {
+        if (mesh_reqs[i].handle == handle) {
+            mesh_reqs[i].done_cb = NULL;
+            err = ESP_OK;
+            break;
+        }
     }
+    xSemaphoreGive(mesh_req_lock);
+    return err;
 }
 
-void send_response(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *data_ptr, uint32_t message_opcode)
-{
-    uint32_t response_opcode = ECS_193_MODEL_OP_RESPONSE;
-    switch (message_opcode)
-    {
-    case ECS_193_MODEL_OP_MESSAGE_R:
-        response_opcode = ECS_193_MODEL_OP_RESPONSE;
-        break;
-    case ECS_193_MODEL_OP_MESSAGE_I_0:
-        response_opcode = ECS_193_MODEL_OP_RESPONSE_I_0;
-        break;
-    case ECS_193_MODEL_OP_MESSAGE_I_1:
-        response_opcode = ECS_193_MODEL_OP_RESPONSE_I_1;
-        break;
-    case ECS_193_MODEL_OP_MESSAGE_I_2:
-        response_opcode = ECS_193_MODEL_OP_RESPONSE_I_2;
-        break;
-    case ECS_193_MODEL_OP_CONNECTIVITY:
-        response_opcode = ECS_193_MODEL_OP_RESPONSE;
-        break;
-
-    default:
-        ESP_LOGE(TAG, "send_response() met invaild Message_Opcode %" PRIu32 ", no corresponding Response_Opcode for it", message_opcode);
-        break;
+static esp_err_t mesh_req_init() {
+    if (mesh_req_lock != NULL) {
+        return ESP_OK;
     }
 
-    esp_err_t err;
+    mesh_req_lock = xSemaphoreCreateMutex();
+    return mesh_req_lock == NULL ? ESP_ERR_NO_MEM : ESP_OK;
+}
 
-    ESP_LOGW(TAG, "response opcode: %" PRIu32, response_opcode);
-    ESP_LOGW(TAG, "response net_idx: %" PRIu16, ctx->net_idx);
-    ESP_LOGW(TAG, "response app_idx: %" PRIu16, ctx->app_idx);
-    ESP_LOGW(TAG, "response addr: %" PRIu16, ctx->addr);
-    ESP_LOGW(TAG, "response recv_dst: %" PRIu16, ctx->recv_dst);
+// ====== outbound send queue, paces client model sends to the stack and retries when it is out of tx contexts ======
+// caller holds mesh_txq_lock, mesh_tx_task reports the change once the lock is released
+static void mesh_txq_update_backpressure() {
+    bool above_high = false;
+    bool below_low = true;
+    uint16_t queued = 0;
+
+    for (int i = 0; i < MESH_TX_LANE_COUNT; i++) {
+        mesh_tx_lane_t *lane = &mesh_tx_lanes[i];
+        above_high |= lane->count * 100 >= lane->size * MESH_TXQ_HIGH_WATER_PCT;
+        below_low &= lane->count * 100 <= lane->size * MESH_TXQ_LOW_WATER_PCT;
+        queued += lane->count;
+    }
 
-    err = esp_ble_mesh_server_model_send_msg(server_model, ctx, response_opcode, length, data_ptr);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to send response to node addr 0x%04x, err_code %d", ctx->addr, err);
-        return;
+    bool congested = mesh_txq_congested;
+    if (!congested && above_high) {
+        congested = true;
+    } else if (congested && below_low) {
+        congested = false;
     }
-    
-}
 
-void send_connectivity(uint16_t dst_address, uint16_t length, uint8_t *data_ptr)
-{
-    esp_ble_mesh_msg_ctx_t ctx = {0};
-    uint32_t opcode = ECS_193_MODEL_OP_CONNECTIVITY;
-    esp_ble_mesh_dev_role_t message_role = MSG_ROLE;
-    esp_err_t err = ESP_OK;
+    if (congested != mesh_txq_congested) {
+        mesh_txq_congested = congested;
+        ESP_LOGW(TAG, "Send queue %s, %d messages queued", congested ? "congested" : "drained", queued);
+    }
+}
 
-    // ESP_LOGW(TAG, "net_idx: %" PRIu16, ble_mesh_key.net_idx);
-    // ESP_LOGW(TAG, "app_idx: %" PRIu16, ble_mesh_key.app_idx);
-    // ESP_LOGW(TAG, "dst_address: %" PRIu16, dst_address);
+// runs in mesh_tx_task without any lock held, the callback may wait on uart or queue another message
+static void mesh_txq_report_backpressure() {
+    uint16_t queued = 0;
 
-    ctx.net_idx = ble_mesh_key.net_idx;
-    ctx.app_idx = ble_mesh_key.app_idx;
-    ctx.addr = dst_address;
-    ctx.send_ttl = ble_message_ttl;
-    
-    ESP_LOGI(TAG, "Trying to ping root\n");
+    xSemaphoreTake(mesh_txq_lock, portMAX_DELAY);
+    bool congested = mesh_txq_congested;
+    bool changed = congested != mesh_txq_congested_reported;
+    mesh_txq_congested_reported = congested;
+    for (int i = 0; i < MESH_TX_LANE_COUNT; i++) {
+        queued += mesh_tx_lanes[i].count;
+    }
+    xSemaphoreGive(mesh_txq_lock);
 
-    err = esp_ble_mesh_client_model_send_msg(client_model, &ctx, opcode, length, data_ptr, MSG_TIMEOUT, true, message_role);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to send message to node addr 0x%04x, err_code %d", dst_address, err);
-        return;
+    if (changed && backpressure_handler_cb != NULL) {
+        backpressure_handler_cb(congested, queued);
     }
 }
 
-void send_connectivity_wrapper(void *arg) {
-    char connectivity_msg[3] = "C";
+static esp_err_t mesh_txq_submit_req(mesh_tx_lane_id_t lane_id, uint16_t dst_address, uint8_t send_ttl, uint32_t opcode,
+    uint16_t length, uint8_t *data_ptr, bool need_rsp, mesh_send_handle_t req_handle) {
+    if (mesh_txq_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    } else if (length > MESH_TXQ_MAX_MSG_LEN) {
+        ESP_LOGE(TAG, "Message %d bytes exceeds MESH_TXQ_MAX_MSG_LEN-%d", length, MESH_TXQ_MAX_MSG_LEN);
+        return ESP_ERR_INVALID_SIZE;
+    }
 
-    send_connectivity(PROV_OWN_ADDR, strlen(connectivity_msg), (uint8_t *) connectivity_msg);
+    xSemaphoreTake(mesh_txq_lock, portMAX_DELAY);
+    mesh_tx_lane_t *lane = &mesh_tx_lanes[lane_id];
+    if (lane->count >= lane->size) {
+        xSemaphoreGive(mesh_txq_lock);
+        ESP_LOGE(TAG, "Send queue lane %d full, message to node addr 0x%04x dropped", lane_id, dst_address);
+        return ESP_ERR_NO_MEM;
+    }
+
+    mesh_tx_entry_t *entry = &lane->entries[(lane->head + lane->count) % lane->size];
+    entry->opcode = opcode;
+    entry->dst_address = dst_address;
+    entry->send_ttl = send_ttl;
+    entry->need_rsp = need_rsp;
+    entry->retries = 0;
+    entry->req_handle = req_handle;
+    entry->length = length;
+    memcpy(entry->data, data_ptr, length);
+    lane->count += 1;
+    if (MESH_VENDOR_OPCODE_LEN + length > MESH_UNSEG_MAX_ACCESS_LEN) {
+        mesh_send_stats.segmented += 1;
+        ESP_LOGD(TAG, "Message 0x%06" PRIx32 " of %d bytes to node addr 0x%04x goes out segmented", opcode, length, dst_address);
+    } else {
+        mesh_send_stats.unsegmented += 1;
+    }
+    mesh_txq_update_backpressure();
+    xSemaphoreGive(mesh_txq_lock);
+
+    xTaskNotifyGive(mesh_tx_task_handle);
+    return ESP_OK;
 }
 
+static esp_err_t mesh_txq_submit(mesh_tx_lane_id_t lane_id, uint16_t dst_address, uint8_t send_ttl, uint32_t opcode, uint16_t length, uint8_t *data_ptr, bool need_rsp) {
+    return mesh_txq_submit_req(lane_id, dst_address, send_ttl, opcode, length, data_ptr, need_rsp, 0);
+}
+
+// active lane's head entry is done with (sent, failed for good, or resubmitted later), caller holds mesh_txq_lock,
+// returns the request handle of a popped entry, 0 when resubmitted or untracked
+static mesh_send_handle_t mesh_txq_finish_head(bool transient_error) {
+    mesh_tx_lane_t *lane = mesh_txq_active;
+    mesh_tx_entry_t *entry = &lane->entries[lane->head];
+    mesh_txq_active = NULL;
+
+    if (transient_error && entry->retries < MESH_TXQ_MAX_RETRY) {
+        // stack busy or out of segment tx contexts, leave it at head and resubmit after a delay, other lanes go meanwhile
+        lane->ready_at = xTaskGetTickCount() + pdMS_TO_TICKS(MESH_TXQ_RETRY_DELAY_MS << entry->retries);
+        entry->retries += 1;
+        ESP_LOGW(TAG, "Stack busy, resubmit message 0x%06" PRIx32 " to node addr 0x%04x, retry %d",
+            entry->opcode, entry->dst_address, entry->retries);
+        return 0;
+    } else if (transient_error) {
+        ESP_LOGE(TAG, "Message 0x%06" PRIx32 " to node addr 0x%04x dropped after %d retries", entry->opcode, entry->dst_address, entry->retries);
+    }
+
+    lane->head = (lane->head + 1) % lane->size;
+    lane->count -= 1;
+    mesh_txq_update_backpressure();
+    return entry->req_handle;
+}
+
+// live stale record of opcode to dst, expired ones are left to mesh_txq_stale_expire(), caller holds mesh_txq_lock
+static mesh_tx_stale_t* mesh_txq_stale_find(uint32_t opcode, uint16_t dst_address) {
+    TickType_t now = xTaskGetTickCount();
+
+    for (int i = 0; i < MESH_TXQ_STALE_SLOTS; i++) {
+        mesh_tx_stale_t *stale = &mesh_txq_stale[i];
+        if (stale->opcode == opcode && stale->dst_address == dst_address && (int32_t) (stale->expires - now) > 0) {
+            return stale;
+        }
+    }
+    return NULL;
+}
+
+// clears expired records, their request handles go to expired for MESH_SEND_UNKNOWN, returns the number of handles,
+// caller holds mesh_txq_lock
+static int mesh_txq_stale_expire(mesh_send_handle_t *expired) {
+    TickType_t now = xTaskGetTickCount();
+    int expired_count = 0;
+
+    for (int i = 0; i < MESH_TXQ_STALE_SLOTS; i++) {
+        mesh_tx_stale_t *stale = &mesh_txq_stale[i];
+        if (stale->opcode == 0 || (int32_t) (stale->expires - now) > 0) {
+            continue;
+        }
+
+        ESP_LOGW(TAG, "No late send complete event for message 0x%06" PRIx32 " to node addr 0x%04x", stale->opcode, stale->dst_address);
+        stale->opcode = 0;
+        if (stale->req_handle != 0) {
+            expired[expired_count++] = stale->req_handle;
+        }
+    }
+    return expired_count;
+}
+
+// ticks until the first stale record expires, portMAX_DELAY when there is none, caller holds mesh_txq_lock
+static TickType_t mesh_txq_stale_next_expiry() {
+    TickType_t wait_ticks = portMAX_DELAY;
+    TickType_t now = xTaskGetTickCount();
+
+    for (int i = 0; i < MESH_TXQ_STALE_SLOTS; i++) {
+        mesh_tx_stale_t *stale = &mesh_txq_stale[i];
+        if (stale->opcode != 0 && (int32_t) (stale->expires - now) < (int32_t) wait_ticks) {
+            wait_ticks = (int32_t) (stale->expires - now) > 0 ? stale->expires - now : 0;
+        }
+    }
+    return wait_ticks;
+}
+
+// caller holds mesh_txq_lock, the record expiring first is replaced when every slot is live, returns the request handle
+// of a replaced record for MESH_SEND_UNKNOWN
+static mesh_send_handle_t mesh_txq_stale_add(uint32_t opcode, uint16_t dst_address, mesh_send_handle_t req_handle) {
+    mesh_tx_stale_t *victim = &mesh_txq_stale[0];
+
+    for (int i = 0; i < MESH_TXQ_STALE_SLOTS; i++) {
+        mesh_tx_stale_t *stale = &mesh_txq_stale[i];
+        if (stale->opcode == 0) {
+            victim = stale;
+            break;
+        } else if ((int32_t) (stale->expires - victim->expires) < 0) {
+            victim = stale;
+        }
+    }
+
+    mesh_send_handle_t replaced = victim->opcode != 0 ? victim->req_handle : 0;
+    victim->opcode = opcode;
+    victim->dst_address = dst_address;
+    victim->expires = xTaskGetTickCount() + pdMS_TO_TICKS(MESH_TXQ_STALE_TIMEOUT_MS);
+    victim->req_handle = req_handle;
+    return replaced;
+}
+
+// live response wait of dst, NULL when a response required send to it may go, caller holds mesh_txq_lock
+static mesh_tx_rsp_wait_t* mesh_txq_rsp_find(uint16_t dst_address) {
+    TickType_t now = xTaskGetTickCount();
+
+    for (int i = 0; i < MESH_TXQ_RSP_SLOTS; i++) {
+        mesh_tx_rsp_wait_t *rsp_wait = &mesh_txq_rsp_wait[i];
+        if (rsp_wait->dst_address == dst_address && (int32_t) (rsp_wait->expires - now) > 0) {
+            return rsp_wait;
+        }
+    }
+    return NULL;
+}
+
+// unused or expired slot, NULL when every one is live, caller holds mesh_txq_lock
+static mesh_tx_rsp_wait_t* mesh_txq_rsp_free_slot() {
+    TickType_t now = xTaskGetTickCount();
+
+    for (int i = 0; i < MESH_TXQ_RSP_SLOTS; i++) {
+        mesh_tx_rsp_wait_t *rsp_wait = &mesh_txq_rsp_wait[i];
+        if (rsp_wait->dst_address == 0 || (int32_t) (rsp_wait->expires - now) <= 0) {
+            return rsp_wait;
+        }
+    }
+    return NULL;
+}
+
+// ticks until the first live response wait expires, portMAX_DELAY when there is none, caller holds mesh_txq_lock
+static TickType_t mesh_txq_rsp_next_expiry() {
+    TickType_t wait_ticks = portMAX_DELAY;
+    TickType_t now = xTaskGetTickCount();
+
+    for (int i = 0; i < MESH_TXQ_RSP_SLOTS; i++) {
+        mesh_tx_rsp_wait_t *rsp_wait = &mesh_txq_rsp_wait[i];
+        if (rsp_wait->dst_address != 0 && (int32_t) (rsp_wait->expires - now) > 0 && rsp_wait->expires - now < wait_ticks) {
+            wait_ticks = rsp_wait->expires - now;
+        }
+    }
+    return wait_ticks;
+}
+
+// caller holds mesh_txq_lock, returns true when dst had a live response wait
+static bool mesh_txq_rsp_clear(uint16_t dst_address) {
+    mesh_tx_rsp_wait_t *rsp_wait = mesh_txq_rsp_find(dst_address);
+    if (rsp_wait != NULL) {
+        rsp_wait->dst_address = 0;
+    }
+    return rsp_wait != NULL;
+}
+
+// response or client timeout event from dst, its next response required send may go, runs in btc task
+static void mesh_txq_rsp_done(uint16_t dst_address) {
+    if (mesh_txq_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(mesh_txq_lock, portMAX_DELAY);
+    bool cleared = mesh_txq_rsp_clear(dst_address);
+    xSemaphoreGive(mesh_txq_lock);
+
+    if (cleared) {
+        xTaskNotifyGive(mesh_tx_task_handle);
+    }
+}
+
+// strict priority, except a lower lane passed over MESH_TXQ_FAIRNESS_BURST times goes next. A lane whose head waits out
+// its resubmit delay, a late send complete event or a response from its destination is skipped so the other lanes keep
+// going, wait_ticks gets the ticks until the first timed wait ends. Caller holds mesh_txq_lock
+static mesh_tx_lane_t* mesh_txq_pick_lane(TickType_t *wait_ticks) {
+    mesh_tx_lane_t *picked = NULL;
+    bool ready[MESH_TX_LANE_COUNT] = {false};
+    TickType_t now = xTaskGetTickCount();
+
+    *wait_ticks = portMAX_DELAY;
+    for (int i = 0; i < MESH_TX_LANE_COUNT; i++) {
+        mesh_tx_lane_t *lane = &mesh_tx_lanes[i];
+        if (lane->count == 0) {
+            continue;
+        }
+
+        mesh_tx_entry_t *entry = &lane->entries[lane->head];
+        if ((int32_t) (lane->ready_at - now) > 0) {
+            if (lane->ready_at - now < *wait_ticks) {
+                *wait_ticks = lane->ready_at - now;
+            }
+            continue;
+        } else if (mesh_txq_stale_find(entry->opcode, entry->dst_address) != NULL) {
+            continue; // held until the late event drained the record or it expired
+        } else if (entry->need_rsp && (mesh_txq_rsp_find(entry->dst_address) != NULL || mesh_txq_rsp_free_slot() == NULL)) {
+            // held until the response or timeout event, which notifies mesh_tx_task
+            if (mesh_txq_rsp_next_expiry() < *wait_ticks) {
+                *wait_ticks = mesh_txq_rsp_next_expiry();
+            }
+            continue;
+        }
+
+        ready[i] = true;
+        if (picked == NULL || lane->passed_over >= MESH_TXQ_FAIRNESS_BURST) {
+            picked = lane;
+            if (lane->passed_over >= MESH_TXQ_FAIRNESS_BURST) {
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < MESH_TX_LANE_COUNT; i++) {
+        mesh_tx_lane_t *lane = &mesh_tx_lanes[i];
+        if (lane == picked) {
+            lane->passed_over = 0;
+        } else if (ready[i] && lane->passed_over < UINT8_MAX) {
+            lane->passed_over += 1;
+        }
+    }
+
+    return picked;
+}
+
+// send complete event from the stack, runs in btc task
+static void mesh_txq_send_complete(esp_ble_mesh_model_t *model, uint32_t opcode, uint16_t dst_address, int err_code) {
+    if (model != client_model) {
+        return; // responses from server model are not queued
+    }
+
+    xSemaphoreTake(mesh_txq_lock, portMAX_DELAY);
+    mesh_tx_stale_t *stale = mesh_txq_stale_find(opcode, dst_address);
+    if (stale != NULL) {
+        // late event of a timed out send, no send with the same opcode and dst was handed to the stack since
+        ESP_LOGW(TAG, "Late send complete event for message 0x%06" PRIx32 " to node addr 0x%04x, err_code %d", opcode, dst_address, err_code);
+        mesh_send_handle_t stale_handle = stale->req_handle;
+        stale->opcode = 0;
+        xSemaphoreGive(mesh_txq_lock);
+        xTaskNotifyGive(mesh_tx_task_handle);
+        mesh_req_send_complete(stale_handle, err_code);
+        return;
+    } else if (mesh_txq_active == NULL) {
+        xSemaphoreGive(mesh_txq_lock);
+        return;
+    }
+
+    mesh_tx_entry_t *entry = &mesh_txq_active->entries[mesh_txq_active->head];
+    if (entry->opcode != opcode || entry->dst_address != dst_address) {
+        xSemaphoreGive(mesh_txq_lock);
+        return;
+    }
+
+    bool transient_error = err_code == -EBUSY || err_code == -ENOBUFS || err_code == -ENOMEM || err_code == -EAGAIN;
+    if (entry->need_rsp && err_code != 0) {
+        mesh_txq_rsp_clear(dst_address); // stack keeps no response wait for a send it failed
+    }
+    mesh_send_handle_t req_handle = mesh_txq_finish_head(transient_error);
+    xSemaphoreGive(mesh_txq_lock);
+
+    xTaskNotifyGive(mesh_tx_task_handle);
+    mesh_req_send_complete(req_handle, err_code);
+}
+
+// hands queued messages to the stack one at a time, next one goes after the send complete event of the previous
+static void mesh_tx_task(void *arg) {
+    TickType_t wait_ticks = portMAX_DELAY;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, wait_ticks);
+        wait_ticks = portMAX_DELAY;
+        // every queue change notifies this task
+        mesh_txq_report_backpressure();
+
+        xSemaphoreTake(mesh_txq_lock, portMAX_DELAY);
+        mesh_send_handle_t expired[MESH_TXQ_STALE_SLOTS];
+        int expired_count = mesh_txq_stale_expire(expired);
+        if (expired_count > 0) {
+            xSemaphoreGive(mesh_txq_lock);
+            for (int i = 0; i < expired_count; i++) {
+                mesh_req_send_unknown(expired[i]);
+            }
+            wait_ticks = 0;
+            continue;
+        }
+
+        TickType_t now = xTaskGetTickCount();
+        if (mesh_txq_active != NULL && (int32_t) (mesh_txq_wait_until - now) > 0) {
+            // waiting for the send complete event
+            wait_ticks = mesh_txq_wait_until - now;
+            xSemaphoreGive(mesh_txq_lock);
+            continue;
+        } else if (mesh_txq_active != NULL) {
+            mesh_tx_entry_t *entry = &mesh_txq_active->entries[mesh_txq_active->head];
+            ESP_LOGW(TAG, "No send complete event for message to node addr 0x%04x", entry->dst_address);
+            // request stays open, the late event or MESH_SEND_UNKNOWN on expiry ends it, host can't tell it was dropped
+            uint32_t opcode = entry->opcode;
+            uint16_t dst_address = entry->dst_address;
+            mesh_send_handle_t req_handle = mesh_txq_finish_head(false);
+            mesh_send_handle_t replaced = mesh_txq_stale_add(opcode, dst_address, req_handle);
+            xSemaphoreGive(mesh_txq_lock);
+            xTaskNotifyGive(mesh_tx_task_handle);
+            mesh_req_send_unknown(replaced);
+            continue;
+        }
+
+        TickType_t held_ticks;
+        mesh_tx_lane_t *lane = mesh_txq_pick_lane(&held_ticks);
+        if (lane == NULL) {
+            // a held lane goes again on the event it waits for, which notifies this task, or once its wait ran out
+            wait_ticks = mesh_txq_stale_next_expiry();
+            if (held_ticks < wait_ticks) {
+                wait_ticks = held_ticks;
+            }
+            xSemaphoreGive(mesh_txq_lock);
+            continue;
+        }
+
+        // head entry is only written again after it's popped, safe to hand to the stack outside the lock
+        mesh_tx_entry_t *entry = &lane->entries[lane->head];
+        mesh_txq_active = lane;
+        mesh_txq_wait_until = now + pdMS_TO_TICKS(MESH_TXQ_COMP_TIMEOUT_MS);
+        if (entry->need_rsp) {
+            mesh_tx_rsp_wait_t *rsp_wait = mesh_txq_rsp_free_slot();
+            rsp_wait->dst_address = entry->dst_address;
+            rsp_wait->expires = now + pdMS_TO_TICKS(MESH_TXQ_RSP_TIMEOUT_MS);
+        }
+        wait_ticks = pdMS_TO_TICKS(MESH_TXQ_COMP_TIMEOUT_MS);
+        xSemaphoreGive(mesh_txq_lock);
+
+        esp_ble_mesh_msg_ctx_t ctx = {0};
+        ctx.net_idx = ble_mesh_key.net_idx;
+        ctx.app_idx = ble_mesh_key.app_idx;
+        ctx.addr = entry->dst_address;
+        ctx.send_ttl = entry->send_ttl;
+
+        setNodeState(WORKING);
+        esp_err_t err = esp_ble_mesh_client_model_send_msg(client_model, &ctx, entry->opcode, entry->length, entry->data,
+            MSG_TIMEOUT, entry->need_rsp, MSG_ROLE);
+        if (err != ESP_OK) {
+            // never reached the stack, no send complete event will come
+            ESP_LOGE(TAG, "Failed to send message to node addr 0x%04x, err_code %d", ctx.addr, err);
+            xSemaphoreTake(mesh_txq_lock, portMAX_DELAY);
+            if (entry->need_rsp) {
+                mesh_txq_rsp_clear(entry->dst_address);
+            }
+            mesh_send_handle_t req_handle = mesh_txq_finish_head(err == ESP_ERR_NO_MEM || err == ESP_FAIL);
+            wait_ticks = 0;
+            xSemaphoreGive(mesh_txq_lock);
+            mesh_req_send_complete(req_handle, err);
+        }
+    }
+}
+
+static esp_err_t mesh_txq_init() {
+    if (mesh_txq_lock != NULL) {
+        return ESP_OK;
+    }
+
+    mesh_txq_lock = xSemaphoreCreateMutex();
+    if (mesh_txq_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(mesh_tx_task, "mesh_tx_task", 1024 * 3, NULL, configMAX_PRIORITIES - 3, &mesh_tx_task_handle) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool mesh_send_is_segmented(mesh_delivery_class_t delivery_class, uint16_t length) {
+    uint16_t access_len = MESH_VENDOR_OPCODE_LEN + length;
+    if (delivery_class == MESH_DELIVERY_IMPORTANT) {
+        access_len += RELIABLE_HDR_LEN;
+    }
+    return access_len > MESH_UNSEG_MAX_ACCESS_LEN;
+}
+
+void mesh_send_get_stats(mesh_send_stats_t *stats) {
+    if (mesh_txq_lock == NULL) {
+        *stats = mesh_send_stats;
+        return;
+    }
+
+    xSemaphoreTake(mesh_txq_lock, portMAX_DELAY);
+    *stats = mesh_send_stats;
+    xSemaphoreGive(mesh_txq_lock);
+}
+
+esp_err_t send_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response)
+{
+    uint32_t opcode = ECS_193_MODEL_OP_MESSAGE;
+    esp_err_t err = ESP_OK;
+
+    // ESP_LOGW(TAG, "dst_address: %" PRIu16, dst_address);
+
+    mesh_tx_lane_id_t lane_id = MESH_TX_LANE_BULK;
+
+    if (require_response) {
+        opcode = ECS_193_MODEL_OP_MESSAGE_R;
+        lane_id = MESH_TX_LANE_RELIABLE;
+    }
+
+    err = mesh_txq_submit(lane_id, dst_address, mesh_ttl_for(dst_address), opcode, length, data_ptr, require_response);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send message to node addr 0x%04x, err_code %d", dst_address, err);
+        return err;
+    }
+
+    return ESP_OK;
+}
+
+// ====== important message, reliable delivery with sequence number and per destination window ======
+// caller holds reliable_lock
+static reliable_peer_t* reliable_get_peer(uint16_t dst_address, bool create) {
+    reliable_peer_t *idle_peer = NULL;
+
+    for (int i = 0; i < MESH_RELIABLE_MAX_PEERS; i++) {
+        if (reliable_peers[i].addr == dst_address) {
+            return &reliable_peers[i];
+        } else if (idle_peer == NULL && reliable_peers[i].in_flight == 0) {
+            idle_peer = &reliable_peers[i];
+        }
+    }
+
+    if (!create || idle_peer == NULL) {
+        return NULL;
+    }
+
+    // random start so a restarted edge or reused entry doesn't repeat recent sequence numbers
+    idle_peer->addr = dst_address;
+    idle_peer->next_seq = (uint16_t) esp_random();
+    idle_peer->in_flight = 0;
+    return idle_peer;
+}
+
+// caller holds reliable_lock
+static void reliable_release(reliable_slot_t *slot) {
+    reliable_peer_t *peer = reliable_get_peer(slot->dst_address, false);
+    if (peer != NULL && peer->in_flight > 0) {
+        peer->in_flight -= 1;
+    }
+
+    slot->in_use = false;
+    reliable_free_slots[reliable_free_count++] = slot - reliable_pool;
+}
+
+static esp_err_t reliable_transmit(uint16_t dst_address, uint8_t send_ttl, uint16_t length, uint8_t *data_ptr, mesh_send_handle_t req_handle) {
+    // no stack level response tracking, it only allows one per destination, acks are matched by sequence instead
+    return mesh_txq_submit_req(MESH_TX_LANE_RELIABLE, dst_address, send_ttl, RELIABLE_OPCODE, length, data_ptr, false, req_handle);
+}
+
+#if MESH_RELIABLE_CUMULATIVE_ACK
+// distance from seq back to the oldest sequence still in flight to dst, receiver treats everything older as done with,
+// caller holds reliable_lock
+static uint8_t reliable_window_back(uint16_t dst_address, uint16_t seq) {
+    uint16_t back = 0;
+    for (int i = 0; i < MESH_RELIABLE_POOL_SIZE; i++) {
+        reliable_slot_t *slot = &reliable_pool[i];
+        uint16_t distance = seq - slot->seq;
+        if (slot->in_use && slot->dst_address == dst_address && (int16_t) distance > 0 && distance > back) {
+            back = distance;
+        }
+    }
+    return back < RELIABLE_BACK_UNKNOWN ? back : RELIABLE_BACK_UNKNOWN;
+}
+#endif
+
+// time until retransmit after the given number of transmissions, doubled each time with random jitter on top
+static int64_t reliable_backoff_us(uint8_t attempts) {
+    int64_t backoff_us = MESH_RELIABLE_TIMEOUT_US;
+    for (int i = 1; i < attempts && backoff_us < MESH_RELIABLE_MAX_BACKOFF_US; i++) {
+        backoff_us *= 2;
+    }
+    if (backoff_us > MESH_RELIABLE_MAX_BACKOFF_US) {
+        backoff_us = MESH_RELIABLE_MAX_BACKOFF_US;
+    }
+
+    uint32_t jitter_range_us = backoff_us * MESH_RELIABLE_JITTER_PCT / 100;
+    return backoff_us + (jitter_range_us ? esp_random() % jitter_range_us : 0);
+}
+
+// arm the one shot timer for the earliest retransmit deadline, caller holds reliable_lock
+static void reliable_schedule() {
+    int64_t earliest_us = INT64_MAX;
+    for (int i = 0; i < MESH_RELIABLE_POOL_SIZE; i++) {
+        if (reliable_pool[i].in_use && reliable_pool[i].next_tx_us < earliest_us) {
+            earliest_us = reliable_pool[i].next_tx_us;
+        }
+    }
+
+    esp_timer_stop(reliable_timer); // not running is fine
+    if (earliest_us == INT64_MAX) {
+        return;
+    }
+
+    int64_t delay_us = earliest_us - esp_timer_get_time();
+    esp_timer_start_once(reliable_timer, delay_us > 0 ? delay_us : 0);
+}
+
+static esp_err_t reliable_send(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, important_done_cb_t done_cb, void *done_ctx,
+    mesh_send_handle_t req_handle);
+
+esp_err_t send_important_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr) {
+    return send_important_message_notify(dst_address, length, data_ptr, NULL, NULL);
+}
+
+esp_err_t send_important_message_notify(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, important_done_cb_t done_cb, void *done_ctx) {
+    return reliable_send(dst_address, length, data_ptr, done_cb, done_ctx, 0);
+}
+
+// req_handle of a mesh_send_async() request rides on the first transmission only, it reports sent once
+static esp_err_t reliable_send(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, important_done_cb_t done_cb, void *done_ctx,
+    mesh_send_handle_t req_handle) {
+    if (reliable_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    } else if (length > MESH_RELIABLE_MAX_MSG_LEN) {
+        ESP_LOGW(TAG, "Important message %d bytes exceeds MESH_RELIABLE_MAX_MSG_LEN-%d", length, MESH_RELIABLE_MAX_MSG_LEN);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(reliable_lock, portMAX_DELAY);
+    reliable_peer_t *peer = reliable_get_peer(dst_address, true);
+    if (peer == NULL || peer->in_flight >= MESH_RELIABLE_WINDOW || reliable_free_count == 0) {
+        xSemaphoreGive(reliable_lock);
+        ESP_LOGW(TAG, "Too many on tracking important message to node addr 0x%04x, failed to add one more", dst_address);
+        return ESP_ERR_NO_MEM;
+    }
+
+    int64_t now = esp_timer_get_time();
+    reliable_slot_t *slot = &reliable_pool[reliable_free_slots[--reliable_free_count]];
+    slot->in_use = true;
+    slot->dst_address = dst_address;
+    slot->seq = peer->next_seq++;
+    slot->length = RELIABLE_HDR_LEN + length;
+    slot->attempts = 1;
+    slot->next_tx_us = now + reliable_backoff_us(slot->attempts);
+    slot->deadline_us = now + MESH_RELIABLE_DEADLINE_US;
+    slot->done_cb = done_cb;
+    slot->done_ctx = done_ctx;
+    slot->data[0] = slot->seq >> 8;
+    slot->data[1] = slot->seq & 0xFF;
+    memcpy(slot->data + RELIABLE_HDR_LEN, data_ptr, length);
+#if MESH_RELIABLE_CUMULATIVE_ACK
+    slot->data[2] = reliable_window_back(dst_address, slot->seq);
+#endif
+    peer->in_flight += 1;
+    reliable_schedule();
+    xSemaphoreGive(reliable_lock);
+
+    // slot can't be acked or reused before its first transmission, safe to send outside the lock
+    uint8_t send_ttl = mesh_ttl_for(dst_address);
+    ESP_LOGI(TAG, "Sending important message seq %d, ttl: %d", slot->seq, send_ttl);
+    esp_err_t err = reliable_transmit(dst_address, send_ttl, slot->length, slot->data, req_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send important message to node addr 0x%04x, err_code %d", dst_address, err);
+        xSemaphoreTake(reliable_lock, portMAX_DELAY);
+        reliable_release(slot);
+        xSemaphoreGive(reliable_lock);
+        return err;
+    }
+
+    return ESP_OK;
+}
+
+static void reliable_ack_received(uint16_t src_address, uint16_t seq) {
+    important_done_cb_t done_cb = NULL;
+    void *done_ctx = NULL;
+
+    xSemaphoreTake(reliable_lock, portMAX_DELAY);
+    for (int i = 0; i < MESH_RELIABLE_POOL_SIZE; i++) {
+        reliable_slot_t *slot = &reliable_pool[i];
+        if (slot->in_use && slot->dst_address == src_address && slot->seq == seq) {
+            done_cb = slot->done_cb;
+            done_ctx = slot->done_ctx;
+            reliable_release(slot);
+            ESP_LOGI(TAG, "Confirm delivered on important message seq %d to node addr 0x%04x", seq, src_address);
+            break;
+        }
+    }
+    xSemaphoreGive(reliable_lock);
+
+    // outside the lock, callback may send another important message
+    if (done_cb != NULL) {
+        done_cb(done_ctx, src_address, true);
+    }
+}
+
+static void reliable_send_ack(esp_ble_mesh_msg_ctx_t *ctx, uint16_t seq) {
+    uint8_t ack[MESH_RELIABLE_HDR_LEN] = {seq >> 8, seq & 0xFF};
+
+    ctx->send_ttl = mesh_ttl_for(ctx->addr);
+    esp_err_t err = esp_ble_mesh_server_model_send_msg(server_model, ctx, ECS_193_MODEL_OP_ACK_I, sizeof(ack), ack);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to ack important message seq %d to node addr 0x%04x, err_code %d", seq, ctx->addr, err);
+    }
+}
+
+// ack of several important messages at once, runs in btc task
+static void reliable_cum_ack_received(uint16_t src_address, uint16_t contiguous, uint32_t bitmap) {
+    important_done_cb_t done_cbs[MESH_RELIABLE_POOL_SIZE];
+    void *done_ctxs[MESH_RELIABLE_POOL_SIZE];
+    int done_count = 0;
+
+    xSemaphoreTake(reliable_lock, portMAX_DELAY);
+    for (int i = 0; i < MESH_RELIABLE_POOL_SIZE; i++) {
+        reliable_slot_t *slot = &reliable_pool[i];
+        uint16_t distance = slot->seq - contiguous;
+        if (!slot->in_use || slot->dst_address != src_address) {
+            continue;
+        } else if ((int16_t) distance <= 0 || (distance <= 32 && ((bitmap >> (distance - 1)) & 1))) {
+            ESP_LOGI(TAG, "Confirm delivered on important message seq %d to node addr 0x%04x", slot->seq, src_address);
+            done_cbs[done_count] = slot->done_cb;
+            done_ctxs[done_count] = slot->done_ctx;
+            done_count += 1;
+            reliable_release(slot);
+        }
+    }
+    xSemaphoreGive(reliable_lock);
+
+    // outside the lock, callback may send another important message
+    for (int i = 0; i < done_count; i++) {
+        if (done_cbs[i] != NULL) {
+            done_cbs[i](done_ctxs[i], src_address, true);
+        }
+    }
+}
+
+// ====== cumulative ack, receiver acks important messages from a node together ======
+// move contiguous forward by distance, then over every received sequence right after it, caller holds cum_ack_lock
+static void cum_ack_slide(cum_ack_peer_t *peer, uint16_t distance) {
+    peer->bitmap = distance >= 32 ? 0 : peer->bitmap >> distance;
+    peer->contiguous += distance;
+    while (peer->bitmap & 1) {
+        peer->contiguous += 1;
+        peer->bitmap >>= 1;
+    }
+}
+
+// caller holds cum_ack_lock
+static void cum_ack_build(cum_ack_peer_t *peer, uint8_t *ack) {
+    ack[0] = peer->contiguous >> 8;
+    ack[1] = peer->contiguous & 0xFF;
+    ack[2] = peer->bitmap >> 24;
+    ack[3] = (peer->bitmap >> 16) & 0xFF;
+    ack[4] = (peer->bitmap >> 8) & 0xFF;
+    ack[5] = peer->bitmap & 0xFF;
+    peer->pending = 0;
+    peer->ack_due_us = INT64_MAX;
+}
+
+// arm the one shot timer for the earliest delayed ack, caller holds cum_ack_lock
+static void cum_ack_schedule() {
+    int64_t earliest_us = INT64_MAX;
+    for (int i = 0; i < MESH_ACK_MAX_PEERS; i++) {
+        if (cum_ack_peers[i].addr != 0 && cum_ack_peers[i].ack_due_us < earliest_us) {
+            earliest_us = cum_ack_peers[i].ack_due_us;
+        }
+    }
+
+    esp_timer_stop(cum_ack_timer); // not running is fine
+    if (earliest_us == INT64_MAX) {
+        return;
+    }
+
+    int64_t delay_us = earliest_us - esp_timer_get_time();
+    esp_timer_start_once(cum_ack_timer, delay_us > 0 ? delay_us : 0);
+}
+
+static void cum_ack_send(uint16_t net_idx, uint16_t app_idx, uint16_t dst_address, uint8_t *ack) {
+    esp_ble_mesh_msg_ctx_t ctx = {0};
+    ctx.net_idx = net_idx;
+    ctx.app_idx = app_idx;
+    ctx.addr = dst_address;
+    ctx.send_ttl = mesh_ttl_for(dst_address);
+
+    esp_err_t err = esp_ble_mesh_server_model_send_msg(server_model, &ctx, ECS_193_MODEL_OP_ACK_C, MESH_ACK_C_LEN, ack);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to ack important messages to node addr 0x%04x, err_code %d", dst_address, err);
+    }
+}
+
+// record an important message for the next cumulative ack, runs in btc task
+static void cum_ack_message_received(esp_ble_mesh_msg_ctx_t *ctx, uint16_t seq, uint8_t back) {
+    uint8_t ack[MESH_ACK_C_LEN];
+    bool ack_now = false;
+    bool individual = back == RELIABLE_BACK_UNKNOWN; // can't place it, ack just this sequence
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(cum_ack_lock, portMAX_DELAY);
+    cum_ack_peer_t *peer = NULL;
+    cum_ack_peer_t *oldest = &cum_ack_peers[0];
+    for (int i = 0; i < MESH_ACK_MAX_PEERS; i++) {
+        if (cum_ack_peers[i].addr == ctx->addr) {
+            peer = &cum_ack_peers[i];
+            break;
+        } else if (cum_ack_peers[i].last_rx_us < oldest->last_rx_us) {
+            oldest = &cum_ack_peers[i];
+        }
+    }
+
+    if (peer != NULL && now - peer->last_rx_us >= MESH_RELIABLE_DEADLINE_US) {
+        // long quiet sender may have restarted with new sequence numbers, start over
+        peer->addr = 0;
+        oldest = peer;
+        peer = NULL;
+    }
+
+    if (peer == NULL && !individual) {
+        // nothing before the new sender's oldest unacked sequence is outstanding
+        peer = oldest;
+        peer->addr = ctx->addr;
+        peer->contiguous = seq - back - 1;
+        peer->bitmap = 0;
+        peer->pending = 0;
+        peer->ack_due_us = INT64_MAX;
+    }
+
+    if (peer != NULL && !individual) {
+        peer->last_rx_us = now;
+        peer->net_idx = ctx->net_idx;
+        peer->app_idx = ctx->app_idx;
+
+        // sender is done with every sequence before its oldest unacked one, acked or given up on
+        uint16_t advance = (uint16_t) (seq - back - 1) - peer->contiguous;
+        if ((int16_t) advance > 0) {
+            cum_ack_slide(peer, advance);
+        }
+
+        uint16_t offset = seq - peer->contiguous;
+        if ((int16_t) offset <= 0 || offset > 32 || ((peer->bitmap >> (offset - 1)) & 1)) {
+            // duplicate after a lost ack, or too far ahead for the bitmap
+            individual = true;
+        } else {
+            peer->bitmap |= 1UL << (offset - 1);
+            cum_ack_slide(peer, 0);
+            peer->pending += 1;
+            if (peer->ack_due_us == INT64_MAX) {
+                peer->ack_due_us = now + MESH_ACK_DELAY_US;
+            }
+            ack_now = peer->pending >= MESH_ACK_EVERY;
+        }
+
+        if (ack_now) {
+            cum_ack_build(peer, ack);
+        }
+        cum_ack_schedule();
+    }
+    xSemaphoreGive(cum_ack_lock);
+
+    if (individual) {
+        reliable_send_ack(ctx, seq);
+    } else if (ack_now) {
+        cum_ack_send(ctx->net_idx, ctx->app_idx, ctx->addr, ack);
+    }
+}
+
+// send delayed acks that are due, runs in esp_timer task
+static void cum_ack_timer_callback(void *arg) {
+    for (int i = 0; i < MESH_ACK_MAX_PEERS; i++) {
+        cum_ack_peer_t *peer = &cum_ack_peers[i];
+        uint8_t ack[MESH_ACK_C_LEN];
+
+        xSemaphoreTake(cum_ack_lock, portMAX_DELAY);
+        if (peer->addr == 0 || peer->ack_due_us > esp_timer_get_time()) {
+            xSemaphoreGive(cum_ack_lock);
+            continue;
+        }
+
+        uint16_t net_idx = peer->net_idx;
+        uint16_t app_idx = peer->app_idx;
+        uint16_t dst_address = peer->addr;
+        cum_ack_build(peer, ack);
+        xSemaphoreGive(cum_ack_lock);
+
+        cum_ack_send(net_idx, app_idx, dst_address, ack);
+    }
+
+    xSemaphoreTake(cum_ack_lock, portMAX_DELAY);
+    cum_ack_schedule();
+    xSemaphoreGive(cum_ack_lock);
+}
+
+static esp_err_t cum_ack_init() {
+    if (cum_ack_lock != NULL) {
+        return ESP_OK;
+    }
+
+    cum_ack_lock = xSemaphoreCreateMutex();
+    if (cum_ack_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < MESH_ACK_MAX_PEERS; i++) {
+        cum_ack_peers[i].ack_due_us = INT64_MAX;
+    }
+
+    const esp_timer_create_args_t cum_ack_timer_args = {
+            .callback = &cum_ack_timer_callback,
+            .name = "cumulative_ack"
+    };
+    return esp_timer_create(&cum_ack_timer_args, &cum_ack_timer);
+}
+
+// true when src and seq was received within MESH_DEDUP_EXPIRE_US, records it otherwise, runs in btc task
+static bool mesh_dedup_seen(uint16_t src_address, uint16_t seq) {
+    uint32_t hash = (((uint32_t) src_address << 16) | seq) * 2654435761u; // multiplicative hash, spreads consecutive seq
+    mesh_dedup_entry_t *set = mesh_dedup_cache[(hash >> 16) & (MESH_DEDUP_SETS - 1)];
+    mesh_dedup_entry_t *victim = &set[0];
+    int64_t now = esp_timer_get_time();
+
+    for (int i = 0; i < MESH_DEDUP_WAYS; i++) {
+        mesh_dedup_entry_t *entry = &set[i];
+        if (entry->src_address == src_address && entry->seq == seq && entry->expires_us > now) {
+            mesh_dedup_stats.hits += 1;
+            ESP_LOGI(TAG, "Duplicate important message seq %d from node addr 0x%04x, %" PRIu32 " duplicates so far",
+                seq, src_address, mesh_dedup_stats.hits);
+            return true;
+        } else if (entry->expires_us < victim->expires_us) {
+            victim = entry;
+        }
+    }
+
+    if (victim->src_address != 0 && victim->expires_us > now) {
+        mesh_dedup_stats.evictions += 1;
+    }
+    victim->src_address = src_address;
+    victim->seq = seq;
+    victim->expires_us = now + MESH_DEDUP_EXPIRE_US;
+    mesh_dedup_stats.misses += 1;
+    return false;
+}
+
+void mesh_dedup_get_stats(mesh_dedup_stats_t *stats) {
+    *stats = mesh_dedup_stats;
+}
+
+// retransmit or give up on important messages past their deadline, runs in esp_timer task
+static void reliable_timer_callback(void *arg) {
+    static uint8_t tx_copy[RELIABLE_HDR_LEN + MESH_RELIABLE_MAX_MSG_LEN];
+
+    for (int i = 0; i < MESH_RELIABLE_POOL_SIZE; i++) {
+        reliable_slot_t *slot = &reliable_pool[i];
+        int64_t now = esp_timer_get_time();
+
+        xSemaphoreTake(reliable_lock, portMAX_DELAY);
+        if (!slot->in_use || slot->next_tx_us > now) {
+            xSemaphoreGive(reliable_lock);
+            continue;
+        }
+
+        // copy out, an ack can free the slot while the retransmit is handed to the stack
+        uint16_t dst_address = slot->dst_address;
+        uint16_t length = slot->length;
+#if MESH_RELIABLE_CUMULATIVE_ACK
+        slot->data[2] = reliable_window_back(dst_address, slot->seq);
+#endif
+        memcpy(tx_copy, slot->data, length);
+
+        if (slot->attempts >= MESH_RELIABLE_MAX_ATTEMPTS || now >= slot->deadline_us) {
+            ESP_LOGW(TAG, "Important message seq %d to node addr 0x%04x not acked after %d attempts, dropped",
+                slot->seq, dst_address, slot->attempts);
+            important_done_cb_t done_cb = slot->done_cb;
+            void *done_ctx = slot->done_ctx;
+            reliable_release(slot);
+            xSemaphoreGive(reliable_lock);
+
+            if (important_failed_handler_cb != NULL) {
+                important_failed_handler_cb(dst_address, length - RELIABLE_HDR_LEN, tx_copy + RELIABLE_HDR_LEN);
+            }
+            if (done_cb != NULL) {
+                done_cb(done_ctx, dst_address, false);
+            }
+            continue;
+        }
+
+        slot->attempts += 1;
+        slot->next_tx_us = now + reliable_backoff_us(slot->attempts);
+        if (slot->next_tx_us > slot->deadline_us) {
+            slot->next_tx_us = slot->deadline_us;
+        }
+        uint8_t tll_increment = (slot->attempts - 1) / 2; // add 1 more ttl per 2 times retransmit to limit ttl
+        xSemaphoreGive(reliable_lock);
+
+        esp_err_t err = reliable_transmit(dst_address, mesh_ttl_for(dst_address) + tll_increment, length, tx_copy, 0);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to retransmit important message to node addr 0x%04x, err_code %d", dst_address, err);
+        }
+    }
+
+    xSemaphoreTake(reliable_lock, portMAX_DELAY);
+    reliable_schedule();
+    xSemaphoreGive(reliable_lock);
+}
+
+static esp_err_t reliable_init() {
+    if (reliable_lock != NULL) {
+        return ESP_OK;
+    }
+
+    reliable_lock = xSemaphoreCreateMutex();
+    if (reliable_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < MESH_RELIABLE_POOL_SIZE; i++) {
+        reliable_pool[i].in_use = false;
+        reliable_free_slots[i] = MESH_RELIABLE_POOL_SIZE - 1 - i;
+    }
+    reliable_free_count = MESH_RELIABLE_POOL_SIZE;
+
+    const esp_timer_create_args_t reliable_timer_args = {
+            .callback = &reliable_timer_callback,
+            .name = "important_msg"
+    };
+    return esp_timer_create(&reliable_timer_args, &reliable_timer);
+}
+
+// ====== large message transfer, fragments streamed in a window and acked with a selective ack bitmap ======
+// caller holds frag_lock
+static bool frag_tx_is_acked(frag_tx_t *tx, uint16_t index) {
+    if (index < tx->next_missing) {
+        return true;
+    } else if (index == tx->next_missing) {
+        return false;
+    }
+
+    uint16_t bit = index - tx->next_missing - 1;
+    return bit < 32 && ((tx->acked_bitmap >> bit) & 1);
+}
+
+// caller holds frag_lock, fragment is copied into the send queue
+static esp_err_t frag_tx_send(frag_tx_t *tx, uint16_t index) {
+    uint8_t frag[MESH_FRAG_HDR_LEN + MESH_FRAG_SIZE];
+    uint16_t offset = index * MESH_FRAG_SIZE;
+    uint16_t frag_len = tx->length - offset < MESH_FRAG_SIZE ? tx->length - offset : MESH_FRAG_SIZE;
+
+    frag[0] = tx->transfer_id;
+    frag[1] = tx->length >> 8;
+    frag[2] = tx->length & 0xFF;
+    frag[3] = index >> 8;
+    frag[4] = index & 0xFF;
+    memcpy(frag + MESH_FRAG_HDR_LEN, tx->data + offset, frag_len);
+    return mesh_txq_submit(MESH_TX_LANE_BULK, tx->dst_address, mesh_ttl_for(tx->dst_address), ECS_193_MODEL_OP_FRAG,
+        MESH_FRAG_HDR_LEN + frag_len, frag, false);
+}
+
+// send new fragments while the window is open, caller holds frag_lock
+static void frag_tx_pump(frag_tx_t *tx) {
+    tx->resume_us = INT64_MAX;
+    while (tx->next_new < tx->frag_count && tx->next_new < tx->next_missing + MESH_FRAG_WINDOW) {
+        if (frag_tx_send(tx, tx->next_new) != ESP_OK) {
+            // send queue full, continue once it had time to drain
+            tx->resume_us = esp_timer_get_time() + MESH_FRAG_RESUME_DELAY_US;
+            return;
+        }
+        tx->next_new += 1;
+    }
+}
+
+// resend unacked fragments in [from, to), caller holds frag_lock
+static void frag_tx_resend(frag_tx_t *tx, uint16_t from, uint16_t to) {
+    for (uint16_t i = from; i < to; i++) {
+        if (!frag_tx_is_acked(tx, i) && frag_tx_send(tx, i) != ESP_OK) {
+            break; // send queue full, next timeout resends the rest
+        }
+    }
+}
+
+// arm the one shot timer for the earliest timeout or resume, caller holds frag_lock
+static void frag_schedule() {
+    int64_t earliest_us = INT64_MAX;
+    for (int i = 0; i < MESH_FRAG_TX_SLOTS; i++) {
+        frag_tx_t *tx = &frag_tx_pool[i];
+        if (!tx->in_use) {
+            continue;
+        }
+        if (tx->timeout_us < earliest_us) {
+            earliest_us = tx->timeout_us;
+        }
+        if (tx->resume_us < earliest_us) {
+            earliest_us = tx->resume_us;
+        }
+    }
+
+    esp_timer_stop(frag_timer); // not running is fine
+    if (earliest_us == INT64_MAX) {
+        return;
+    }
+
+    int64_t delay_us = earliest_us - esp_timer_get_time();
+    esp_timer_start_once(frag_timer, delay_us > 0 ? delay_us : 0);
+}
+
+esp_err_t send_large_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, important_done_cb_t done_cb, void *done_ctx) {
+    if (frag_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    } else if (length == 0 || length > MESH_FRAG_MAX_MSG_LEN) {
+        ESP_LOGW(TAG, "Large message %d bytes exceeds MESH_FRAG_MAX_MSG_LEN-%d", length, MESH_FRAG_MAX_MSG_LEN);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(frag_lock, portMAX_DELAY);
+    frag_tx_t *tx = NULL;
+    for (int i = 0; i < MESH_FRAG_TX_SLOTS; i++) {
+        if (!frag_tx_pool[i].in_use) {
+            tx = &frag_tx_pool[i];
+            break;
+        }
+    }
+    if (tx == NULL) {
+        xSemaphoreGive(frag_lock);
+        ESP_LOGW(TAG, "Too many large messages in flight, failed to send one to node addr 0x%04x", dst_address);
+        return ESP_ERR_NO_MEM;
+    }
+
+    tx->in_use = true;
+    tx->dst_address = dst_address;
+    tx->transfer_id = frag_next_transfer_id++;
+    tx->length = length;
+    tx->frag_count = (length + MESH_FRAG_SIZE - 1) / MESH_FRAG_SIZE;
+    tx->next_missing = 0;
+    tx->acked_bitmap = 0;
+    tx->next_new = 0;
+    tx->resent_below = 0;
+    tx->attempts = 0;
+    tx->timeout_us = esp_timer_get_time() + MESH_FRAG_TIMEOUT_US;
+    tx->done_cb = done_cb;
+    tx->done_ctx = done_ctx;
+    memcpy(tx->data, data_ptr, length);
+
+    frag_tx_pump(tx);
+    if (tx->next_new == 0) {
+        tx->in_use = false;
+        xSemaphoreGive(frag_lock);
+        ESP_LOGE(TAG, "Send queue full, failed to start large message to node addr 0x%04x", dst_address);
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Sending large message id %d, %d bytes in %d fragments to node addr 0x%04x",
+        tx->transfer_id, length, tx->frag_count, dst_address);
+    frag_schedule();
+    xSemaphoreGive(frag_lock);
+    return ESP_OK;
+}
+
+// selective ack from receiver, runs in btc task
+static void frag_ack_received(uint16_t src_address, uint8_t *ack) {
+    uint8_t transfer_id = ack[0];
+    uint8_t status = ack[1];
+    uint16_t next_missing = (ack[2] << 8) | ack[3];
+    uint32_t bitmap = ((uint32_t) ack[4] << 24) | ((uint32_t) ack[5] << 16) | ((uint32_t) ack[6] << 8) | ack[7];
+    important_done_cb_t done_cb = NULL;
+    void *done_ctx = NULL;
+    bool acked = false;
+
+    xSemaphoreTake(frag_lock, portMAX_DELAY);
+    frag_tx_t *tx = NULL;
+    for (int i = 0; i < MESH_FRAG_TX_SLOTS; i++) {
+        if (frag_tx_pool[i].in_use && frag_tx_pool[i].dst_address == src_address && frag_tx_pool[i].transfer_id == transfer_id) {
+            tx = &frag_tx_pool[i];
+            break;
+        }
+    }
+
+    if (tx == NULL || status == MESH_FRAG_STATUS_NO_BUFFER || next_missing < tx->next_missing || next_missing > tx->frag_count) {
+        // unknown or finished transfer, receiver busy (timeout retries), or ack overtaken by a newer one
+        xSemaphoreGive(frag_lock);
+        return;
+    } else if (status == MESH_FRAG_STATUS_TOO_LARGE || next_missing == tx->frag_count) {
+        acked = status == MESH_FRAG_STATUS_OK;
+        ESP_LOGI(TAG, "Large message id %d to node addr 0x%04x %s", transfer_id, src_address, acked ? "delivered" : "rejected, too large");
+        done_cb = tx->done_cb;
+        done_ctx = tx->done_ctx;
+        tx->in_use = false;
+        frag_schedule();
+        xSemaphoreGive(frag_lock);
+
+        if (done_cb != NULL) {
+            done_cb(done_ctx, src_address, acked);
+        }
+        return;
+    }
+
+    if (next_missing == tx->next_missing) {
+        bitmap |= tx->acked_bitmap;
+    }
+    if (next_missing > tx->next_missing || bitmap != tx->acked_bitmap) {
+        tx->attempts = 0;
+        tx->timeout_us = esp_timer_get_time() + MESH_FRAG_TIMEOUT_US;
+    }
+    tx->next_missing = next_missing;
+    tx->acked_bitmap = bitmap;
+
+    // fragments missing below an acked one were lost on the way, resend each once until next timeout
+    uint16_t acked_end = bitmap ? next_missing + 1 + (32 - __builtin_clz(bitmap)) : next_missing;
+    if (tx->resent_below < next_missing) {
+        tx->resent_below = next_missing;
+    }
+    if (acked_end > tx->resent_below) {
+        frag_tx_resend(tx, tx->resent_below, acked_end);
+        tx->resent_below = acked_end;
+    }
+
+    frag_tx_pump(tx);
+    frag_schedule();
+    xSemaphoreGive(frag_lock);
+}
+
+// resend on ack timeout, give up after MESH_FRAG_MAX_ATTEMPTS, or continue after a full send queue, runs in esp_timer task
+static void frag_timer_callback(void *arg) {
+    for (int i = 0; i < MESH_FRAG_TX_SLOTS; i++) {
+        frag_tx_t *tx = &frag_tx_pool[i];
+        int64_t now = esp_timer_get_time();
+
+        xSemaphoreTake(frag_lock, portMAX_DELAY);
+        if (!tx->in_use) {
+            xSemaphoreGive(frag_lock);
+            continue;
+        }
+
+        if (tx->timeout_us <= now && tx->attempts + 1 >= MESH_FRAG_MAX_ATTEMPTS) {
+            ESP_LOGW(TAG, "Large message id %d to node addr 0x%04x stalled at fragment %d/%d, dropped",
+                tx->transfer_id, tx->dst_address, tx->next_missing, tx->frag_count);
+            uint16_t dst_address = tx->dst_address;
+            important_done_cb_t done_cb = tx->done_cb;
+            void *done_ctx = tx->done_ctx;
+            tx->in_use = false;
+            xSemaphoreGive(frag_lock);
+
+            if (done_cb != NULL) {
+                done_cb(done_ctx, dst_address, false);
+            }
+            continue;
+        } else if (tx->timeout_us <= now) {
+            // no ack progress, ack or fragments lost, resend everything unacked in the window
+            tx->attempts += 1;
+            tx->timeout_us = now + MESH_FRAG_TIMEOUT_US;
+            ESP_LOGW(TAG, "Large message id %d to node addr 0x%04x timeout, resend from fragment %d",
+                tx->transfer_id, tx->dst_address, tx->next_missing);
+            frag_tx_resend(tx, tx->next_missing, tx->next_new);
+            tx->resent_below = tx->next_new;
+        }
+
+        if (tx->resume_us <= now) {
+            frag_tx_pump(tx);
+        }
+        xSemaphoreGive(frag_lock);
+    }
+
+    xSemaphoreTake(frag_lock, portMAX_DELAY);
+    frag_schedule();
+    xSemaphoreGive(frag_lock);
+}
+
+static void frag_send_ack(esp_ble_mesh_msg_ctx_t *ctx, uint8_t *ack) {
+    ctx->send_ttl = mesh_ttl_for(ctx->addr);
+    esp_err_t err = esp_ble_mesh_server_model_send_msg(server_model, ctx, ECS_193_MODEL_OP_FRAG_ACK, MESH_FRAG_ACK_LEN, ack);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to ack large message id %d to node addr 0x%04x, err_code %d", ack[0], ctx->addr, err);
+    }
+}
+
+// caller holds frag_lock
+static void frag_rx_build_ack(frag_rx_t *rx, uint8_t *ack) {
+    uint32_t bitmap = 0;
+    for (int bit = 0; bit < 32 && rx->next_missing + 1 + bit < rx->frag_count; bit++) {
+        uint16_t index = rx->next_missing + 1 + bit;
+        if ((rx->received[index / 32] >> (index % 32)) & 1) {
+            bitmap |= 1UL << bit;
+        }
+    }
+
+    ack[0] = rx->transfer_id;
+    ack[1] = MESH_FRAG_STATUS_OK;
+    ack[2] = rx->next_missing >> 8;
+    ack[3] = rx->next_missing & 0xFF;
+    ack[4] = bitmap >> 24;
+    ack[5] = (bitmap >> 16) & 0xFF;
+    ack[6] = (bitmap >> 8) & 0xFF;
+    ack[7] = bitmap & 0xFF;
+    rx->unacked = 0;
+}
+
+// free buffer, else a delivered one, else one idle past MESH_FRAG_RX_TIMEOUT_US, caller holds frag_lock
+static frag_rx_t* frag_rx_alloc(int64_t now) {
+    frag_rx_t *reusable = NULL;
+
+    for (int i = 0; i < MESH_FRAG_RX_SLOTS; i++) {
+        frag_rx_t *rx = &frag_rx_pool[i];
+        if (!rx->in_use) {
+            return rx;
+        } else if (reusable == NULL && (rx->complete || now - rx->last_rx_us >= MESH_FRAG_RX_TIMEOUT_US)) {
+            reusable = rx;
+        }
+    }
+    return reusable;
+}
+
+// fragment of a large message, runs in btc task
+static void frag_received(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg) {
+    uint8_t transfer_id = msg[0];
+    uint16_t total_length = (msg[1] << 8) | msg[2];
+    uint16_t index = (msg[3] << 8) | msg[4];
+    uint16_t frag_len = length - MESH_FRAG_HDR_LEN;
+    uint16_t frag_count = (total_length + MESH_FRAG_SIZE - 1) / MESH_FRAG_SIZE;
+    uint8_t ack[MESH_FRAG_ACK_LEN] = {transfer_id, MESH_FRAG_STATUS_OK};
+    int64_t now = esp_timer_get_time();
+
+    if (total_length > MESH_FRAG_MAX_MSG_LEN) {
+        ESP_LOGW(TAG, "Large message %d bytes from node addr 0x%04x exceeds MESH_FRAG_MAX_MSG_LEN-%d", total_length, ctx->addr, MESH_FRAG_MAX_MSG_LEN);
+        ack[1] = MESH_FRAG_STATUS_TOO_LARGE;
+        frag_send_ack(ctx, ack);
+        return;
+    } else if (index >= frag_count || frag_len != (index == frag_count - 1 ? total_length - index * MESH_FRAG_SIZE : MESH_FRAG_SIZE)) {
+        ESP_LOGW(TAG, "Malformed fragment %d of large message id %d from node addr 0x%04x", index, transfer_id, ctx->addr);
+        return;
+    }
+
+    xSemaphoreTake(frag_lock, portMAX_DELAY);
+    frag_rx_t *rx = NULL;
+    for (int i = 0; i < MESH_FRAG_RX_SLOTS; i++) {
+        frag_rx_t *entry = &frag_rx_pool[i];
+        if (entry->in_use && entry->src_address == ctx->addr && entry->transfer_id == transfer_id && entry->length == total_length) {
+            rx = entry;
+            break;
+        }
+    }
+
+    if (rx == NULL) {
+        rx = frag_rx_alloc(now);
+        if (rx == NULL) {
+            xSemaphoreGive(frag_lock);
+            ESP_LOGW(TAG, "No reassembly buffer for large message id %d from node addr 0x%04x", transfer_id, ctx->addr);
+            ack[1] = MESH_FRAG_STATUS_NO_BUFFER;
+            frag_send_ack(ctx, ack);
+            return;
+        }
+
+        rx->in_use = true;
+        rx->complete = false;
+        rx->src_address = ctx->addr;
+        rx->transfer_id = transfer_id;
+        rx->length = total_length;
+        rx->frag_count = frag_count;
+        rx->next_missing = 0;
+        rx->unacked = 0;
+        memset(rx->received, 0, sizeof(rx->received));
+    }
+    rx->last_rx_us = now;
+
+    bool deliver = false;
+    bool ack_now = true; // duplicate, sender missed our ack
+    if (!rx->complete && !((rx->received[index / 32] >> (index % 32)) & 1)) {
+        ack_now = index != rx->next_missing; // gap, let sender resend the missing ones
+        rx->received[index / 32] |= 1UL << (index % 32);
+        memcpy(rx->data + index * MESH_FRAG_SIZE, msg + MESH_FRAG_HDR_LEN, frag_len);
+        rx->unacked += 1;
+
+        while (rx->next_missing < rx->frag_count && ((rx->received[rx->next_missing / 32] >> (rx->next_missing % 32)) & 1)) {
+            rx->next_missing += 1;
+        }
+        deliver = rx->complete = rx->next_missing == rx->frag_count;
+        ack_now |= deliver || rx->unacked >= MESH_FRAG_ACK_EVERY;
+    }
+
+    if (ack_now) {
+        frag_rx_build_ack(rx, ack);
+    }
+    xSemaphoreGive(frag_lock);
+
+    if (ack_now) {
+        frag_send_ack(ctx, ack);
+    }
+
+    // buffer is only reused by frag_rx_alloc() in this same task, safe to hand out outside the lock
+    if (deliver) {
+        ESP_LOGI(TAG, "Received large message id %d, %d bytes from node addr 0x%04x", transfer_id, total_length, ctx->addr);
+        recv_message_handler_cb(ctx, rx->length, rx->data, ECS_193_MODEL_OP_FRAG);
+    }
+}
+
+static esp_err_t frag_init() {
+    if (frag_lock != NULL) {
+        return ESP_OK;
+    }
+
+    frag_lock = xSemaphoreCreateMutex();
+    if (frag_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // random start so a restarted edge doesn't look like a retransmit of a message receiver just delivered
+    frag_next_transfer_id = (uint8_t) esp_random();
+
+    const esp_timer_create_args_t frag_timer_args = {
+            .callback = &frag_timer_callback,
+            .name = "large_msg"
+    };
+    return esp_timer_create(&frag_timer_args, &frag_timer);
+}
+
+esp_err_t broadcast_message(uint16_t length, uint8_t *data_ptr)
+{
+    esp_err_t err = ESP_OK;
+
+    err = mesh_txq_submit(MESH_TX_LANE_BULK, 0xFFFF, ble_message_ttl, ECS_193_MODEL_OP_BROADCAST, length, data_ptr, false);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send message to node addr 0xFFFF, err_code %d", err);
+        return err;
+    }
+
+    return ESP_OK;
+}
+
+// ====== group address publish/subscribe, group messages only reach and get relayed for subscribed nodes ======
+esp_err_t subscribe_group(uint16_t group_address)
+{
+    if (!ESP_BLE_MESH_ADDR_IS_GROUP(group_address)) {
+        ESP_LOGE(TAG, "Address 0x%04x is not a group address", group_address);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = esp_ble_mesh_model_subscribe_group_addr(esp_ble_mesh_get_primary_element_address(), ECS_193_CID,
+        ECS_193_MODEL_ID_SERVER, group_address);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to subscribe group addr 0x%04x, err_code %d", group_address, err);
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Subscribed group addr 0x%04x", group_address);
+    return ESP_OK;
+}
+
+esp_err_t unsubscribe_group(uint16_t group_address)
+{
+    if (!ESP_BLE_MESH_ADDR_IS_GROUP(group_address)) {
+        ESP_LOGE(TAG, "Address 0x%04x is not a group address", group_address);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = esp_ble_mesh_model_unsubscribe_group_addr(esp_ble_mesh_get_primary_element_address(), ECS_193_CID,
+        ECS_193_MODEL_ID_SERVER, group_address);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to unsubscribe group addr 0x%04x, err_code %d", group_address, err);
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Unsubscribed group addr 0x%04x", group_address);
+    return ESP_OK;
+}
+
+esp_err_t send_group_message(uint16_t group_address, uint16_t length, uint8_t *data_ptr)
+{
+    esp_err_t err = ESP_OK;
+
+    if (!ESP_BLE_MESH_ADDR_IS_GROUP(group_address)) {
+        ESP_LOGE(TAG, "Address 0x%04x is not a group address", group_address);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // same opcode as broadcast, subscribers get it through broadcast_handler with recv_dst set to the group
+    err = mesh_txq_submit(MESH_TX_LANE_BULK, group_address, ble_message_ttl, ECS_193_MODEL_OP_BROADCAST, length, data_ptr, false);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send message to group addr 0x%04x, err_code %d", group_address, err);
+        return err;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t send_control_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr)
+{
+    esp_err_t err = ESP_OK;
+
+    err = mesh_txq_submit(MESH_TX_LANE_CONTROL, dst_address, mesh_ttl_for(dst_address), ECS_193_MODEL_OP_MESSAGE, length, data_ptr, false);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send control message to node addr 0x%04x, err_code %d", dst_address, err);
+        return err;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t mesh_send(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, mesh_delivery_class_t delivery_class)
+{
+    switch (delivery_class) {
+    case MESH_DELIVERY_NORMAL:
+        return send_message(dst_address, length, data_ptr, false);
+    case MESH_DELIVERY_RESPONSE:
+        return send_message(dst_address, length, data_ptr, true);
+    case MESH_DELIVERY_IMPORTANT:
+        return send_important_message(dst_address, length, data_ptr);
+    case MESH_DELIVERY_BROADCAST:
+        return broadcast_message(length, data_ptr);
+    case MESH_DELIVERY_CONTROL:
+        return send_control_message(dst_address, length, data_ptr);
+    default:
+        ESP_LOGE(TAG, "mesh_send() met invaild delivery class %d", delivery_class);
+        return ESP_ERR_INVALID_ARG;
+    }
+}
+
+esp_err_t mesh_send_async(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, mesh_delivery_class_t delivery_class,
+    mesh_send_done_cb_t done_cb, void *user_ctx, mesh_send_handle_t *handle)
+{
+    esp_err_t err = ESP_OK;
+
+    if (mesh_req_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    } else if (delivery_class == MESH_DELIVERY_BROADCAST) {
+        dst_address = 0xFFFF;
+    }
+
+    mesh_send_handle_t req_handle = mesh_req_alloc(delivery_class, dst_address, done_cb, user_ctx);
+    if (req_handle == 0) {
+        ESP_LOGW(TAG, "Too many async send requests outstanding, message to node addr 0x%04x dropped", dst_address);
+        return ESP_ERR_NO_MEM;
+    }
+    if (handle != NULL) {
+        *handle = req_handle;
+    }
+
+    // same lanes and opcodes as mesh_send(), with the handle riding on the queue entry
+    switch (delivery_class) {
+    case MESH_DELIVERY_NORMAL:
+        err = mesh_txq_submit_req(MESH_TX_LANE_BULK, dst_address, mesh_ttl_for(dst_address), ECS_193_MODEL_OP_MESSAGE, length, data_ptr, false, req_handle);
+        break;
+    case MESH_DELIVERY_RESPONSE:
+        err = mesh_txq_submit_req(MESH_TX_LANE_RELIABLE, dst_address, mesh_ttl_for(dst_address), ECS_193_MODEL_OP_MESSAGE_R, length, data_ptr, true, req_handle);
+        break;
+    case MESH_DELIVERY_IMPORTANT:
+        err = reliable_send(dst_address, length, data_ptr, mesh_req_important_done, (void *) (uintptr_t) req_handle, req_handle);
+        break;
+    case MESH_DELIVERY_BROADCAST:
+        err = mesh_txq_submit_req(MESH_TX_LANE_BULK, dst_address, ble_message_ttl, ECS_193_MODEL_OP_BROADCAST, length, data_ptr, false, req_handle);
+        break;
+    case MESH_DELIVERY_CONTROL:
+        err = mesh_txq_submit_req(MESH_TX_LANE_CONTROL, dst_address, mesh_ttl_for(dst_address), ECS_193_MODEL_OP_MESSAGE, length, data_ptr, false, req_handle);
+        break;
+    default:
+        ESP_LOGE(TAG, "mesh_send_async() met invaild delivery class %d", delivery_class);
+        err = ESP_ERR_INVALID_ARG;
+        break;
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send async message to node addr 0x%04x, err_code %d", dst_address, err);
+        mesh_req_free(req_handle);
+        return err;
+    }
+
+    return ESP_OK;
+}
+
+void send_response(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *data_ptr, uint32_t message_opcode)
+{
+    uint32_t response_opcode = ECS_193_MODEL_OP_RESPONSE;
+    switch (message_opcode)
+    {
+    case ECS_193_MODEL_OP_MESSAGE_R:
+        response_opcode = ECS_193_MODEL_OP_RESPONSE;
+        break;
+    case ECS_193_MODEL_OP_MESSAGE_I_0:
+        response_opcode = ECS_193_MODEL_OP_RESPONSE_I_0;
+        break;
+    case ECS_193_MODEL_OP_MESSAGE_I_1:
+        response_opcode = ECS_193_MODEL_OP_RESPONSE_I_1;
+        break;
+    case ECS_193_MODEL_OP_MESSAGE_I_2:
+        response_opcode = ECS_193_MODEL_OP_RESPONSE_I_2;
+        break;
+    case ECS_193_MODEL_OP_CONNECTIVITY:
+        response_opcode = ECS_193_MODEL_OP_RESPONSE;
+        break;
+
+    default:
+        ESP_LOGE(TAG, "send_response() met invaild Message_Opcode %" PRIu32 ", no corresponding Response_Opcode for it", message_opcode);
+        break;
+    }
+
+    esp_err_t err;
+
+    ESP_LOGW(TAG, "response opcode: %" PRIu32, response_opcode);
+    ESP_LOGW(TAG, "response net_idx: %" PRIu16, ctx->net_idx);
+    ESP_LOGW(TAG, "response app_idx: %" PRIu16, ctx->app_idx);
+    ESP_LOGW(TAG, "response addr: %" PRIu16, ctx->addr);
+    ESP_LOGW(TAG, "response recv_dst: %" PRIu16, ctx->recv_dst);
+
+    ctx->send_ttl = mesh_ttl_for(ctx->addr);
+    err = esp_ble_mesh_server_model_send_msg(server_model, ctx, response_opcode, length, data_ptr);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send response to node addr 0x%04x, err_code %d", ctx->addr, err);
+        return;
+    }
+    
+}
+
+void send_connectivity(uint16_t dst_address, uint16_t length, uint8_t *data_ptr)
+{
+    esp_err_t err = ESP_OK;
+
+    ESP_LOGI(TAG, "Trying to ping root\n");
+
+    // global ttl, the ping also checks the root is still reachable when the route got longer
+    err = mesh_txq_submit(MESH_TX_LANE_CONTROL, dst_address, ble_message_ttl, ECS_193_MODEL_OP_CONNECTIVITY, length, data_ptr, true);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send message to node addr 0x%04x, err_code %d", dst_address, err);
+        return;
+    }
+}
+
+void send_connectivity_wrapper(void *arg) {
+    char connectivity_msg[3] = "C";
+
+    send_connectivity(PROV_OWN_ADDR, strlen(connectivity_msg), (uint8_t *) connectivity_msg);
+}
+
+// ====== standard mesh heartbeat, replaces the connectivity ping with MESH_HEARTBEAT ======
+// heartbeat from root, hops is 1 when root is in direct range, runs in btc task
+static void mesh_heartbeat_recv(uint8_t hops, uint16_t feature) {
+    // subscription only lets heartbeats from root through
+    mesh_ttl_learn_relays(PROV_OWN_ADDR, hops > 0 ? hops - 1 : 0);
+
+    if (mesh_heartbeat_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(mesh_heartbeat_lock, portMAX_DELAY);
+    if (mesh_heartbeat_stats.received == 0 || hops < mesh_heartbeat_stats.min_hops) {
+        mesh_heartbeat_stats.min_hops = hops;
+    }
+    if (hops > mesh_heartbeat_stats.max_hops) {
+        mesh_heartbeat_stats.max_hops = hops;
+    }
+    mesh_heartbeat_stats.hops = hops;
+    mesh_heartbeat_stats.received += 1;
+    mesh_heartbeat_stats.last_rx_us = esp_timer_get_time();
+    xSemaphoreGive(mesh_heartbeat_lock);
+    ESP_LOGD(TAG, "Heartbeat from root, %d hops, features 0x%04x", hops, feature);
+}
+
+#if MESH_HEARTBEAT
+// subscription was set again, hop count range starts over from the last heartbeat, runs in btc task
+static void mesh_heartbeat_range_reset() {
+    xSemaphoreTake(mesh_heartbeat_lock, portMAX_DELAY);
+    mesh_heartbeat_stats.min_hops = mesh_heartbeat_stats.hops;
+    mesh_heartbeat_stats.max_hops = mesh_heartbeat_stats.hops;
+    xSemaphoreGive(mesh_heartbeat_lock);
+}
+#endif
+
+void mesh_heartbeat_get_stats(mesh_heartbeat_stats_t *stats) {
+    if (mesh_heartbeat_lock == NULL) {
+        *stats = mesh_heartbeat_stats;
+        return;
+    }
+
+    xSemaphoreTake(mesh_heartbeat_lock, portMAX_DELAY);
+    *stats = mesh_heartbeat_stats;
+    xSemaphoreGive(mesh_heartbeat_lock);
+}
+
+#if MESH_HEARTBEAT
+// config message to the node's own config server, looped back by the stack without going on air
+static esp_err_t mesh_heartbeat_config_set(uint32_t opcode, esp_ble_mesh_cfg_client_set_state_t *set_state) {
+    esp_ble_mesh_client_common_param_t common = {0};
+
+    common.opcode = opcode;
+    common.model = &root_models[ARRAY_SIZE(root_models) - 1];
+    common.ctx.net_idx = ble_mesh_key.net_idx;
+    common.ctx.app_idx = ESP_BLE_MESH_KEY_DEV;
+    common.ctx.addr = esp_ble_mesh_get_primary_element_address();
+    common.ctx.send_ttl = 0;
+    common.msg_timeout = 0; // default client timeout
+
+    esp_err_t err = esp_ble_mesh_config_client_set_state(&common, set_state);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send heartbeat config 0x%04" PRIx32 ", err_code %d", opcode, err);
+    }
+    return err;
+}
+
+// unacked heartbeat to root every 2^(MESH_HEARTBEAT_PUB_PERIOD_LOG - 1) s until changed
+static esp_err_t mesh_heartbeat_pub_set() {
+    esp_ble_mesh_cfg_client_set_state_t set_state = {0};
+
+    set_state.heartbeat_pub_set.dst = PROV_OWN_ADDR;
+    set_state.heartbeat_pub_set.count = 0xFF; // publish indefinitely
+    set_state.heartbeat_pub_set.period = MESH_HEARTBEAT_PUB_PERIOD_LOG;
+    set_state.heartbeat_pub_set.ttl = ble_message_ttl;
+    set_state.heartbeat_pub_set.feature = 0;
+    set_state.heartbeat_pub_set.net_idx = ble_mesh_key.net_idx;
+    return mesh_heartbeat_config_set(ESP_BLE_MESH_MODEL_OP_HEARTBEAT_PUB_SET, &set_state);
+}
+
+// subscription runs out after its period, also resets the hop count range kept by the stack
+static esp_err_t mesh_heartbeat_sub_set() {
+    esp_ble_mesh_cfg_client_set_state_t set_state = {0};
+
+    set_state.heartbeat_sub_set.src = PROV_OWN_ADDR;
+    set_state.heartbeat_sub_set.dst = MESH_HEARTBEAT_SUB_DST;
+    set_state.heartbeat_sub_set.period = MESH_HEARTBEAT_SUB_PERIOD_LOG;
+    return mesh_heartbeat_config_set(ESP_BLE_MESH_MODEL_OP_HEARTBEAT_SUB_SET, &set_state);
+}
+
+// runs in esp_timer task every heartbeat period, stats are reset once the stack confirms the subscription
+static void mesh_heartbeat_check(void *arg) {
+    int64_t now = esp_timer_get_time();
+
+    if (now - mesh_heartbeat_renew_us >= MESH_HEARTBEAT_SUB_RENEW_US) {
+        mesh_heartbeat_renew_us = now;
+        mesh_heartbeat_sub_set();
+    }
+
+    xSemaphoreTake(mesh_heartbeat_lock, portMAX_DELAY);
+    int64_t last_rx_us = mesh_heartbeat_stats.last_rx_us;
+    xSemaphoreGive(mesh_heartbeat_lock);
+
+    // root unreachable, same path as an unanswered connectivity ping
+    int64_t since_us = last_rx_us != 0 ? last_rx_us : mesh_heartbeat_start_us;
+    if (now - since_us >= MESH_HEARTBEAT_MISS_LIMIT * MESH_HEARTBEAT_PERIOD_US) {
+        ESP_LOGW(TAG, "No heartbeat from root for %lld s", (now - since_us) / 1000000);
+        esp_ble_mesh_msg_ctx_t ctx = {0};
+        ctx.net_idx = ble_mesh_key.net_idx;
+        ctx.app_idx = ble_mesh_key.app_idx;
+        ctx.addr = PROV_OWN_ADDR;
+        timeout_handler_cb(&ctx, ECS_193_MODEL_OP_CONNECTIVITY);
+    }
+}
+#endif
+
 void loop_message_connection() {
+#if MESH_HEARTBEAT
+    ESP_LOGI(TAG, "----- HEARTBEAT STARTED -----\n");
+    periodic_timer_start = true;
+    mesh_heartbeat_started = true;
+    mesh_heartbeat_start_us = esp_timer_get_time();
+    mesh_heartbeat_renew_us = mesh_heartbeat_start_us;
+    mesh_heartbeat_pub_set();
+    mesh_heartbeat_sub_set();
+
+    const esp_timer_create_args_t periodic_timer_args = {
+            .callback = &mesh_heartbeat_check,
+            .name = "heartbeat_check"
+    };
+
+    ESP_ERROR_CHECK(esp_timer_create(&periodic_timer_args, &periodic_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(periodic_timer, MESH_HEARTBEAT_PERIOD_US));
+#else
     ESP_LOGI(TAG, "----- LOOP MESSAGE STARTED -----\n");
     periodic_timer_start = true;
     const esp_timer_create_args_t periodic_timer_args = {
@@ -759,6 +2919,7 @@ void loop_message_connection() {
 
     ESP_ERROR_CHECK(esp_timer_start_periodic(periodic_timer, timer_for_ping));
     ESP_LOGI(TAG, "Started periodic timers, time since boot: %lld us", esp_timer_get_time());
+#endif
 }
 
 enum State getNodeState() {
@@ -791,7 +2952,16 @@ static esp_err_t ble_mesh_init(void)
 
     esp_ble_mesh_register_prov_callback(ble_mesh_provisioning_cb);
     esp_ble_mesh_register_config_server_callback(example_ble_mesh_config_server_cb);
+#if MESH_HEARTBEAT
+    esp_ble_mesh_register_config_client_callback(ble_mesh_config_client_cb);
+#endif
     esp_ble_mesh_register_custom_model_callback(ble_mesh_custom_model_cb);
+
+    err = mesh_op_build_tables();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to build vendor model op tables");
+        return err;
+    }
     esp_ble_mesh_register_rpr_server_callback(example_remote_prov_server_callback);
 
     err = esp_ble_mesh_init(&provision, &composition);
@@ -824,7 +2994,7 @@ void reset_esp32()
     board_led_operation(0,0,0); //turn off the LED
     char edge_restart_message[20] = "RST";
     uint16_t msg_length = strlen(edge_restart_message);
-    broadcast_message(msg_length, (uint8_t *)edge_restart_message);
+    mesh_txq_submit(MESH_TX_LANE_CONTROL, 0xFFFF, ble_message_ttl, ECS_193_MODEL_OP_BROADCAST, msg_length, (uint8_t *)edge_restart_message, false);
 
 #if CONFIG_BLE_MESH_SETTINGS
     // erase the persistent memory
@@ -857,7 +3027,9 @@ esp_err_t esp_module_edge_init(
     void (*recv_response_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode),
     void (*timeout_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint32_t opcode),
     void (*broadcast_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr),
-    void (*connectivity_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr)
+    void (*connectivity_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr),
+    void (*important_failed_handler)(uint16_t dst_address, uint16_t length, uint8_t *msg_ptr),
+    void (*backpressure_handler)(bool congested, uint16_t queued)
 ) {
     esp_err_t err;
 
@@ -871,13 +3043,53 @@ esp_err_t esp_module_edge_init(
     timeout_handler_cb = timeout_handler;
     broadcast_handler_cb = broadcast_handler;
     connectivity_handler_cb = connectivity_handler;
+    important_failed_handler_cb = important_failed_handler;
+    backpressure_handler_cb = backpressure_handler;
     if (prov_complete_handler_cb == NULL || recv_message_handler_cb == NULL || recv_response_handler_cb == NULL || 
-        timeout_handler_cb == NULL || broadcast_handler_cb == NULL || timeout_handler_cb == NULL || connectivity_handler_cb == NULL) {
+        timeout_handler_cb == NULL || broadcast_handler_cb == NULL || timeout_handler_cb == NULL || connectivity_handler_cb == NULL ||
+        important_failed_handler_cb == NULL || backpressure_handler_cb == NULL) {
         ESP_LOGE(TAG, "Application Level Callback function is NULL");
         return ESP_FAIL;
     }
 
-    
+
+    // ready before the mesh stack can deliver acks
+    err = reliable_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Important message tracking init failed (err %d)", err);
+        return ESP_FAIL;
+    }
+
+    err = cum_ack_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cumulative ack init failed (err %d)", err);
+        return ESP_FAIL;
+    }
+
+    err = mesh_req_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Async send request tracking init failed (err %d)", err);
+        return ESP_FAIL;
+    }
+
+    err = mesh_txq_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Send queue init failed (err %d)", err);
+        return ESP_FAIL;
+    }
+
+    err = mesh_ttl_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Adaptive ttl init failed (err %d)", err);
+        return ESP_FAIL;
+    }
+
+    err = frag_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Large message transfer init failed (err %d)", err);
+        return ESP_FAIL;
+    }
+
     err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES) {
         ESP_ERROR_CHECK(nvs_flash_erase());
@@ -911,13 +3123,6 @@ esp_err_t esp_module_edge_init(
     ESP_ERROR_CHECK(esp_timer_create(&oneshot_timer_args, &oneshot_timer));
     ESP_ERROR_CHECK(esp_timer_start_once(oneshot_timer, 3000000));
 
-    if (important_message_data_list == NULL) {
-        important_message_data_list = (uint8_t**) malloc(3 * sizeof(uint8_t*));
-        for (int i=0; i<3; i++) {
-            important_message_data_list[i] = NULL;
-            important_message_retransmit_times[i] = 0;
-        }
-    }
 
     return ESP_OK;
 }
\ No newline at end of file
@@ -17,8 +17,78 @@
 #ifndef _BLE_EDGE_H_
 #define _BLE_EDGE_H_
 
+// delivery class for mesh_send()
+typedef enum {
+    MESH_DELIVERY_NORMAL,       // unacknowledged message
+    MESH_DELIVERY_RESPONSE,     // message expecting response, timeout handler triggered if not recived
+    MESH_DELIVERY_IMPORTANT,    // tracked and retransmitted until response recived
+    MESH_DELIVERY_BROADCAST,    // message to all nodes, dst_address ignored
+    MESH_DELIVERY_CONTROL,      // unacknowledged message sent ahead of queued normal and important messages
+} mesh_delivery_class_t;
+
+typedef struct {
+    uint32_t unsegmented;       // messages queued that fit one network pdu
+    uint32_t segmented;         // messages queued that need transport segmentation and acks
+} mesh_send_stats_t;
+
+typedef struct {
+    uint32_t hits;              // retransmitted important messages acked again but not delivered
+    uint32_t misses;            // important messages delivered
+    uint32_t evictions;         // live entries replaced before expiry, a retransmit of those is delivered again
+} mesh_dedup_stats_t;
+
+typedef struct {
+    uint32_t received;          // heartbeats from root received, MESH_HEARTBEAT only
+    uint8_t hops;               // hop count of the last one, 1 when root is in direct range
+    uint8_t min_hops;           // smallest and largest hop count since the subscription was last set
+    uint8_t max_hops;
+    int64_t last_rx_us;         // esp_timer time of the last one, 0 when none received
+} mesh_heartbeat_stats_t;
+
+// invoked once per important message, acked true when delivery confirmed, false when given up on
+typedef void (*important_done_cb_t)(void *done_ctx, uint16_t dst_address, bool acked);
+
+// request handle returned by mesh_send_async(), 0 is never a valid handle
+typedef uint32_t mesh_send_handle_t;
+
+// outcome reported to mesh_send_done_cb_t
+typedef enum {
+    MESH_SEND_SENT,             // handed to the radio, last report for normal, broadcast and control messages
+    MESH_SEND_ACKED,            // response or ack received, last report
+    MESH_SEND_TIMEOUT,          // no response within MSG_TIMEOUT, or important message given up on, last report
+    MESH_SEND_FAILED,           // never sent, err_code set, last report
+    MESH_SEND_UNKNOWN,          // stack never reported send complete, may or may not have gone out, last report
+} mesh_send_status_t;
+
+typedef struct {
+    mesh_send_handle_t handle;
+    mesh_send_status_t status;
+    uint16_t dst_address;
+    int err_code;               // MESH_SEND_FAILED, stack error from send complete event or esp_err_t if never handed to stack,
+                                // ESP_ERR_TIMEOUT with MESH_SEND_UNKNOWN
+    uint16_t length;            // MESH_SEND_ACKED of MESH_DELIVERY_RESPONSE only, response message
+    uint8_t *msg_ptr;           // valid during the callback only
+} mesh_send_result_t;
+
+// invoked with MESH_SEND_SENT first when the delivery class waits for a response or ack, then once with the outcome
+typedef void (*mesh_send_done_cb_t)(const mesh_send_result_t *result, void *user_ctx);
+
+// how an ECS_193 opcode is used by this node, bits combined for mesh_register_opcode()
+typedef enum {
+    MESH_OP_SERVER_RX = 0x01,   // received by server model, requests and unsolicited messages
+    MESH_OP_CLIENT_RX = 0x02,   // received by client model, responses to our response required messages
+    MESH_OP_CLIENT_TX = 0x04,   // sent by client model, paired with its response opcode
+} mesh_op_dir_t;
+
+// invoked from the btc task for every received message of the registered opcode
+typedef void (*mesh_op_handler_t)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode);
+
 /**
  * @brief Loop message connection for handling incoming and outgoing messages.
+ * 
+ *  Pings root with ECS_193_MODEL_OP_CONNECTIVITY every timer_for_ping, or with MESH_HEARTBEAT enabled, sets up
+ *  heartbeat publication to root and subscription to root heartbeats on the node's own config server instead.
+ *  The timeout handler is then invoked every period once MESH_HEARTBEAT_MISS_LIMIT root heartbeats are missed.
  */
 void loop_message_connection();
 
@@ -58,16 +128,105 @@ void set_message_ttl(uint8_t new_ttl);
  * @param length Length of message (bytes)
  * @param data_ptr pointer to data buffer that holds message
  * @param require_response flag that indicate if this message expecting response, timeout will get triger if response not recived
+ * @return ESP_OK if message queued for the mesh stack, ESP_ERR_NO_MEM if send queue is full
  */
-void send_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response);
+esp_err_t send_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response);
 
 /**
  * @brief Broadcast Message (bytes) to all node in network
  *
  * @param length Length of message (bytes)
  * @param data_ptr pointer to data buffer that holds message
+ * @return ESP_OK if message queued for the mesh stack, ESP_ERR_NO_MEM if send queue is full
+ */
+esp_err_t broadcast_message(uint16_t length, uint8_t *data_ptr);
+
+/**
+ * @brief Subscribe the vendor server model to a group address
+ *
+ *  Messages sent to the group with send_group_message() reach broadcast_handler with ctx->recv_dst set to the group.
+ *  Up to CONFIG_BLE_MESH_MODEL_GROUP_COUNT groups, root can also add them with the config model.
+ *
+ * @param group_address group address, 0xC000 to 0xFEFF
+ * @return ESP_OK if subscribed, ESP_ERR_INVALID_ARG if not a group address, error from the stack when subscription list is full
+ */
+esp_err_t subscribe_group(uint16_t group_address);
+
+/**
+ * @brief Unsubscribe the vendor server model from a group address
+ *
+ * @param group_address group address, 0xC000 to 0xFEFF
+ * @return ESP_OK if unsubscribed, ESP_ERR_INVALID_ARG if not a group address
+ */
+esp_err_t unsubscribe_group(uint16_t group_address);
+
+/**
+ * @brief Send Message (bytes) to every node subscribed to a group address
+ *
+ *  Unlike broadcast_message(), nodes not subscribed to the group drop it without passing it to the application.
+ *
+ * @param group_address group address, 0xC000 to 0xFEFF
+ * @param length Length of message (bytes)
+ * @param data_ptr pointer to data buffer that holds message
+ * @return ESP_OK if message queued for the mesh stack, ESP_ERR_INVALID_ARG if not a group address, ESP_ERR_NO_MEM if send queue is full
+ */
+esp_err_t send_group_message(uint16_t group_address, uint16_t length, uint8_t *data_ptr);
+
+/**
+ * @brief Send Control Message (bytes) to another node in network
+ *
+ *  Same as an unacknowledged send_message() but queued on the control lane, it goes out ahead of queued
+ *  important, response required and normal messages.
+ *
+ * @param dst_address  Dstination node's unicast address
+ * @param length Length of message (bytes)
+ * @param data_ptr pointer to data buffer that holds message
+ * @return ESP_OK if message queued for the mesh stack, ESP_ERR_NO_MEM if control lane is full
+ */
+esp_err_t send_control_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr);
+
+/**
+ * @brief Send Message (bytes) straight to the mesh send layer, for in-process callers such as local edge device
+ *
+ *  No command encoding on the way. The message is copied into the send queue (important messages into the reliable
+ *  pool), so data_ptr can be reused once this returns.
+ *
+ * @param dst_address  Dstination node's unicast address
+ * @param length Length of message (bytes)
+ * @param data_ptr pointer to data buffer that holds message
+ * @param delivery_class how the message is delivered, see mesh_delivery_class_t
+ * @return ESP_OK if message queued for the mesh stack, ESP_ERR_NO_MEM if send queue is full
+ */
+esp_err_t mesh_send(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, mesh_delivery_class_t delivery_class);
+
+/**
+ * @brief Send Message (bytes) and get notified of its outcome through a per request callback
+ *
+ *  Same delivery as mesh_send(), done_cb reports sent, acked, timeout or failed for this message only so callers can
+ *  keep many requests outstanding without matching global callbacks. A response to MESH_DELIVERY_RESPONSE is passed
+ *  to done_cb and to recv_response_handler as before. done_cb is not invoked when this function returns an error.
+ *
+ * @param dst_address  Dstination node's unicast address, ignored for MESH_DELIVERY_BROADCAST
+ * @param length Length of message (bytes)
+ * @param data_ptr pointer to data buffer that holds message, copied before return
+ * @param delivery_class how the message is delivered, see mesh_delivery_class_t
+ * @param done_cb callback on every report, invoked from the btc, mesh_tx or esp_timer task, can run before this
+ *        function returns
+ * @param user_ctx passed back to done_cb
+ * @param handle set to the request handle before the message is queued, can be NULL
+ * @return ESP_OK if message queued for the mesh stack, ESP_ERR_NO_MEM if MESH_REQ_POOL_SIZE requests outstanding or
+ *         send queue is full
+ */
+esp_err_t mesh_send_async(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, mesh_delivery_class_t delivery_class,
+    mesh_send_done_cb_t done_cb, void *user_ctx, mesh_send_handle_t *handle);
+
+/**
+ * @brief Drop the completion callback of an outstanding request, the message itself is still delivered
+ *
+ * @param handle request handle from mesh_send_async()
+ * @return ESP_OK if detached, ESP_ERR_NOT_FOUND if the request already completed
  */
-void broadcast_message(uint16_t length, uint8_t *data_ptr);
+esp_err_t mesh_send_detach(mesh_send_handle_t handle);
 
 /**
  * @brief Send Response (bytes) to an recived message
@@ -82,40 +241,102 @@ void send_response(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *data_p
 /**
  * @brief Send an Important Message (bytes) to an node
  * 
- *  This function send and tracks an important message, it will retransmit the important message with higher ttl after timeout for 2 times.
+ *  This function send and tracks an important message with a 2 byte sequence number in front of the message, the receiver
+ *  acks that sequence, or with MESH_RELIABLE_CUMULATIVE_ACK acks several sequences at once. Message is kept in a fixed pool and retransmitted with exponential backoff, random jitter and higher ttl
+ *  until acked, or given up on after MESH_RELIABLE_MAX_ATTEMPTS or MESH_RELIABLE_DEADLINE_US (important_failed_handler is invoked).
+ *  Up to MESH_RELIABLE_WINDOW important messages can be in flight per destination.
  *
  * @param dst_address  Dstination node's unicast address
- * @param length Length of message (bytes)
- * @param data_ptr pointer to data buffer that holds message
+ * @param length Length of message (bytes), up to MESH_RELIABLE_MAX_MSG_LEN
+ * @param data_ptr pointer to data buffer that holds message, copied before return
+ * @return ESP_OK if message queued for the mesh stack, ESP_ERR_NO_MEM if destination window, pool or send queue is full
  */
-void send_important_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr);
+esp_err_t send_important_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr);
 
 /**
- * @brief Get the on-tracking Important Message's index
+ * @brief Send an Important Message (bytes) to an node and get notified of the outcome
+ * 
+ *  Same as send_important_message(), done_cb is invoked once the message is acked or given up on. It is
+ *  not invoked when this function returns an error.
  *
- * @param opcode Message or Response opcode of an important message
+ * @param dst_address  Dstination node's unicast address
+ * @param length Length of message (bytes), up to MESH_RELIABLE_MAX_MSG_LEN
+ * @param data_ptr pointer to data buffer that holds message, copied before return
+ * @param done_cb callback on ack or give up, invoked from the btc or esp_timer task, can be NULL
+ * @param done_ctx passed back to done_cb
+ * @return ESP_OK if message queued for the mesh stack, ESP_ERR_NO_MEM if destination window, pool or send queue is full
  */
-int8_t get_important_message_index(uint32_t opcode);
+esp_err_t send_important_message_notify(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, important_done_cb_t done_cb, void *done_ctx);
 
 /**
- * @brief Retransmit an Important Message (bytes) to an node
+ * @brief Send a Large Message (bytes) above the mesh SDU limit to an node
  * 
- *  This function retransmit the important message with higher ttl after timeout for 2 times.
+ *  The message is split in MESH_FRAG_SIZE fragments, up to MESH_FRAG_WINDOW of them in flight. The receiver acks with
+ *  the first missing fragment and a bitmap of the ones received past it, the sender resends only the missing ones.
+ *  The receiver reassembles in a fixed buffer pool and delivers the whole message to recv_message_handler with
+ *  opcode ECS_193_MODEL_OP_FRAG.
  *
- * @param ctx_ptr poninter to message context of timeout important message
- * @param opcode Message opcode of an important message
- * @param index Index  of on-tracking Important Message
+ * @param dst_address  Dstination node's unicast address
+ * @param length Length of message (bytes), up to MESH_FRAG_MAX_MSG_LEN
+ * @param data_ptr pointer to data buffer that holds message, copied before return
+ * @param done_cb callback once every fragment is acked or the transfer is given up on, invoked from the btc or
+ *        esp_timer task, can be NULL
+ * @param done_ctx passed back to done_cb
+ * @return ESP_OK if transfer started, ESP_ERR_NO_MEM if MESH_FRAG_TX_SLOTS transfers in flight or send queue is full
+ */
+esp_err_t send_large_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, important_done_cb_t done_cb, void *done_ctx);
+
+/**
+ * @brief Register an ECS_193 vendor opcode with the network module
+ *
+ *  The vendor model op tables and client response pairing are generated from registered opcodes when
+ *  esp_module_edge_init() starts the mesh stack, so opcodes are registered before it. Received messages are
+ *  dispatched to handler by table lookup on the opcode, messages shorter than min_len are dropped by the stack.
+ *
+ * @param opcode 3 byte vendor opcode, ESP_BLE_MESH_MODEL_OP_3(0x00-0x3F, ECS_193_CID)
+ * @param directions mesh_op_dir_t bits
+ * @param min_len shortest message accepted when received
+ * @param handler callback for received messages, can be NULL for opcodes only sent
+ * @param rsp_opcode response opcode when sent with MESH_OP_CLIENT_TX, ECS_193_MODEL_OP_EMPTY if none
+ * @return ESP_OK if registered, ESP_ERR_INVALID_ARG for a non ECS_193 or already registered opcode, ESP_ERR_NO_MEM
+ *         once MESH_OP_MAX_REGISTERED are registered, ESP_ERR_INVALID_STATE after the mesh stack started
+ */
+esp_err_t mesh_register_opcode(uint32_t opcode, uint8_t directions, uint16_t min_len, mesh_op_handler_t handler, uint32_t rsp_opcode);
+
+/**
+ * @brief Check whether a message goes out segmented.
+ * 
+ *  Access payload of MESH_VENDOR_OPCODE_LEN opcode, header added by the delivery class and message above
+ *  MESH_UNSEG_MAX_ACCESS_LEN is segmented, which takes transport acks and a segment tx context.
+ *
+ * @param delivery_class how the message is delivered, see mesh_delivery_class_t
+ * @param length Length of message (bytes)
+ * @return true if segmented
+ */
+bool mesh_send_is_segmented(mesh_delivery_class_t delivery_class, uint16_t length);
+
+/**
+ * @brief Get a snapshot of the segmented and unsegmented send counters.
+ * 
+ * @param stats Pointer to the struct to fill.
+ */
+void mesh_send_get_stats(mesh_send_stats_t *stats);
+
+/**
+ * @brief Get a snapshot of the received important message duplicate cache counters.
+ * 
+ * @param stats Pointer to the struct to fill.
  */
-void retransmit_important_message(esp_ble_mesh_msg_ctx_t* ctx_ptr, uint32_t opcode, int8_t index);
+void mesh_dedup_get_stats(mesh_dedup_stats_t *stats);
 
 /**
- * @brief Clear the tracking on an Important Message
+ * @brief Get a snapshot of the heartbeat counters and the hop count to root.
  * 
- *  This function clears the tracking on 1) successful transmission wwith response 2) faild all transmission
+ *  Only counts with MESH_HEARTBEAT enabled, once loop_message_connection() has set up the subscription.
  * 
- * @param index Index  of on-tracking Important Message
+ * @param stats Pointer to the struct to fill.
  */
-void clear_important_message(int8_t index);
+void mesh_heartbeat_get_stats(mesh_heartbeat_stats_t *stats);
 
 /**
  * @brief Reset the module and Erase persistent memeory if persistent memeory is enabled.
@@ -139,6 +360,11 @@ void restart_edge();
  * @param timeout_handler Callback function triggered on timeout on previously sent message without expected response
  * @param broadcast_handler_cb Callback function triggered on reciving incoming broadcase message
  * @param connectivity_handler_cb Callback function triggered on reciving incoming connectivity message (heartbeat connection check)
+ * @param important_failed_handler Callback function triggered when an important message is given up on, after
+ *        MESH_RELIABLE_MAX_ATTEMPTS transmissions or MESH_RELIABLE_DEADLINE_US without ack
+ * @param backpressure_handler Callback function triggered when any outbound send queue lane passes MESH_TXQ_HIGH_WATER_PCT
+ *        (congested) and again when every lane drained to MESH_TXQ_LOW_WATER_PCT, runs in the mesh tx task with no
+ *        queue lock held
  */
 esp_err_t esp_module_edge_init(
     void (*prov_complete_handler)(uint16_t node_index, const esp_ble_mesh_octet16_t uuid, uint16_t addr, uint8_t element_num, uint16_t net_idx),
@@ -147,7 +373,9 @@ esp_err_t esp_module_edge_init(
     void (*recv_response_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr, uint32_t opcode),
     void (*timeout_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint32_t opcode),
     void (*broadcast_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr),
-    void (*connectivity_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr)
+    void (*connectivity_handler)(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint8_t *msg_ptr),
+    void (*important_failed_handler)(uint16_t dst_address, uint16_t length, uint8_t *msg_ptr),
+    void (*backpressure_handler)(bool congested, uint16_t queued)
 );
 
 #endif /* _BLE_EDGE_H_ */
\ No newline at end of file
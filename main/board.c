@@ -8,30 +8,79 @@
  */
 
 #include <stdio.h>
+#include <inttypes.h>
 #include "esp_log.h"
 #include "iot_button.h"
 #include <string.h>
 #include <time.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
 #include "board.h"
-
-#if LOCAL_EDGE_DEVICE
-    #include "local_edge_device.c"
-#endif
+#include "local_edge_device.h"
 
 #define TAG_B "BOARD"
 #define TAG_W "Debug"
 
-extern void send_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response);
+extern esp_err_t send_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr, bool require_response);
 extern void printNetworkInfo();
-extern void create_data_send_event();
-extern void stop_data_send_event();
-extern void sendRobotRequest();
 extern void reset_edge();
-extern void send_important_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr);
+extern esp_err_t send_important_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr);
 
 clock_t start_time;
 bool timeout = false;
 
+// one frame is encoded and written at a time, also keeps frames from different tasks from interleaving
+static SemaphoreHandle_t uart_tx_lock = NULL;
+static uint8_t uart_tx_frame_buf[UART_TX_FRAME_BUF_SIZE];
+static QueueHandle_t uart_event_queue = NULL;
+
+// ring of encoded frames, producers from any task take uart_tx_queue_lock to advance head, tail claimed by consumer
+typedef struct {
+    uint16_t length;
+    bool keep; // queued by uart_sendData_wait(), never dropped as the oldest frame
+    uint8_t frame[UART_TX_FRAME_BUF_SIZE];
+} uart_tx_slot_t;
+
+static uart_tx_slot_t uart_tx_slots[UART_TX_QUEUE_LEN];
+static atomic_uint uart_tx_head = 0;
+static atomic_uint uart_tx_tail = 0; // also advanced by producer when dropping oldest
+static SemaphoreHandle_t uart_tx_queue_lock = NULL;
+
+// ring of encoded events, served before uart_tx_slots, producers take uart_tx_queue_lock, tail only moved by consumer
+typedef struct {
+    uint16_t length;
+    uint8_t frame[UART_FRAME_ENCODED_LEN(UART_TX_EVT_MAX_PAYLOAD_LEN)];
+} uart_tx_evt_slot_t;
+
+static uart_tx_evt_slot_t uart_tx_evt_slots[UART_TX_EVT_QUEUE_LEN];
+static atomic_uint uart_tx_evt_head = 0;
+static atomic_uint uart_tx_evt_tail = 0;
+static TaskHandle_t uart_tx_task_handle = NULL;
+static uart_tx_stats_t uart_tx_stats = {0};
+
+// uart credit flow control, link byte counts on both ends, host side ones come from its credit command
+#if UART_CREDIT_FLOW
+_Static_assert(UART_RX_CREDIT_WINDOW - UART_RX_CREDIT_UPDATE_BYTES >= UART_FRAME_ENCODED_LEN(UART_RX_FRAME_MAX_LEN),
+    "host must fit a largest frame in the credit it has left once the module drained its input");
+#endif
+static atomic_uint uart_tx_bytes = 0;       // written to the link, updated under uart_tx_lock
+static atomic_uint uart_host_consumed = 0;  // read by host, as of its last credit
+static atomic_uint uart_host_window = 0;    // 0 until host sends a credit, credits not honored
+static atomic_uint uart_rx_consumed = 0;    // drained from the driver and executed
+static atomic_uint uart_rx_reported = 0;    // consumed count last sent to host
+
+// uart link settings, previous ones are kept until host confirms a baud rate switch
+static const uint32_t uart_supported_bauds[] = {115200, 230400, 460800, 921600, 1500000, 2000000};
+static uint32_t uart_link_baud = UART_BAUD_RATE;
+static bool uart_link_flow_ctrl = false;
+static uint32_t uart_prev_baud = UART_BAUD_RATE;
+static bool uart_prev_flow_ctrl = false;
+static atomic_bool uart_baud_pending = false; // cleared by whoever settles the switch, confirm or rollback
+static esp_timer_handle_t uart_baud_timer = NULL;
+
 void startTimer() {
     start_time = clock();
 }
@@ -92,44 +141,6 @@ static void board_led_init(void)
     rmt_encoder_init();
 }
 
-// ====================== repetive code, better clean up ======================
-void board_dispatch_network_command(char *ble_cmd, uint16_t node_addr, uint8_t *data_buffer, size_t data_length)
-{
-    uint8_t command_msg[MAX_MSG_LEN + BLE_CMD_LEN + BLE_ADDR_LEN];
-    memset(command_msg, 0, MAX_MSG_LEN + BLE_CMD_LEN + BLE_ADDR_LEN);
-    uint8_t *msg_itr = command_msg;
-    uint16_t node_addr_network_order = htons(node_addr);
-
-    if (data_length > MAX_MSG_LEN)
-    {
-        ESP_LOGE(TAG_L, "Local Edge Device Trying to Send %d bytes message that's more than MAX_MSG_LEN-%d", (int)data_length, (int)MAX_MSG_LEN);
-        return;
-    }
-
-    memcpy(msg_itr, ble_cmd, BLE_CMD_LEN);
-    msg_itr += BLE_CMD_LEN;
-    memcpy(msg_itr, &node_addr_network_order, BLE_ADDR_LEN);
-    msg_itr += BLE_ADDR_LEN;
-
-    if (data_buffer != NULL)
-    {
-        memcpy(msg_itr, data_buffer, data_length);
-        msg_itr += data_length;
-    }
-
-    ESP_LOGI(TAG_L, "data_buffer: '%.*s'", data_length, data_buffer);
-    execute_network_command((char *)command_msg, msg_itr - command_msg);
-}
-
-void board_ble_send_to_root(uint8_t *data_buffer, size_t data_length)
-{
-    char ble_cmd[7] = "SEND-";
-    ESP_LOGI(TAG_L, "data_buffer: '%.*s'", data_length, data_buffer);
-    board_dispatch_network_command(ble_cmd, 0, data_buffer, data_length);
-}
-
-// ====================== repetive code, better clean up ======================
-
 static void button_tap_cb(void* arg)
 {
     ESP_LOGW(TAG_W, "button taped ------------------------- ");
@@ -201,68 +212,189 @@ static void uart_init() {  // Uart =============================================
         .rx_flow_ctrl_thresh = UART_SCLK_DEFAULT, // = 122,
     };
 
+#if UART_RX_MODE == UART_RX_MODE_EVENT
+    ESP_ERROR_CHECK(uart_driver_install(uart_num, uart_buffer_size,
+                                        uart_buffer_size, UART_EVENT_QUEUE_LEN, &uart_event_queue, 0));
+#else
     ESP_ERROR_CHECK(uart_driver_install(uart_num, uart_buffer_size,
                                         uart_buffer_size, 0, NULL, 0)); // not using queue
-                                        // uart_buffer_size, 20, &uart_queue, 0));
+#endif
     // Configure UART parameters
     ESP_ERROR_CHECK(uart_param_config(uart_num, &uart_config));
     // Set UART pins                      (TX,      RX,      RTS,     CTS)
     ESP_ERROR_CHECK(uart_set_pin(uart_num, TXD_PIN, RXD_PIN, RTS_PIN, CTS_PIN));
 
+#if UART_RX_MODE == UART_RX_MODE_EVENT
+    // raise UART_PATTERN_DET as soon as a frame end byte arrives, 0xFE never shows up escaped inside a frame
+    ESP_ERROR_CHECK(uart_enable_pattern_det_baud_intr(uart_num, UART_END, 1, 1, 0, 0));
+    ESP_ERROR_CHECK(uart_pattern_queue_reset(uart_num, UART_PATTERN_QUEUE_LEN));
+#endif
+
+    uart_tx_lock = xSemaphoreCreateMutex();
+    if (uart_tx_lock == NULL) {
+        ESP_LOGE(TAG_B, "Failed to create uart tx lock");
+    }
+
     ESP_LOGI(TAG_B, "Uart init done");
 }
 
-// escape char
-int uart_write_encoded_bytes(uart_port_t uart_num, uint8_t* data, size_t length) {
-    uint8_t esacpe_byte = ESCAPE_BYTE;
+QueueHandle_t uart_get_event_queue(void) {
+    return uart_event_queue;
+}
 
-    int byte_wrote = 0;
-    for (uint8_t* byte_itr = data; byte_itr < data + length; ++byte_itr) {
-        if (byte_itr[0] < esacpe_byte) {
-            uart_write_bytes(UART_NUM, byte_itr, 1);
-            byte_wrote += 1;
-            continue;
+static void uart_link_apply(uint32_t baud_rate, bool flow_ctrl) {
+    // hold tx lock so no frame goes out half in old and half in new baud rate
+    xSemaphoreTake(uart_tx_lock, portMAX_DELAY);
+    uart_wait_tx_done(UART_NUM, pdMS_TO_TICKS(100));
+
+    ESP_ERROR_CHECK(uart_set_baudrate(UART_NUM, baud_rate));
+    if (flow_ctrl) {
+        ESP_ERROR_CHECK(uart_set_pin(UART_NUM, TXD_PIN, RXD_PIN, FLOW_RTS_PIN_H2, FLOW_CTS_PIN_H2));
+        ESP_ERROR_CHECK(uart_set_hw_flow_ctrl(UART_NUM, UART_HW_FLOWCTRL_CTS_RTS, UART_FLOW_CTRL_THRESH));
+    } else {
+        ESP_ERROR_CHECK(uart_set_hw_flow_ctrl(UART_NUM, UART_HW_FLOWCTRL_DISABLE, 0));
+        if (uart_link_flow_ctrl) {
+            // detach the flow control pins, uart_set_pin() leaves pins it isn't given routed
+            gpio_reset_pin(FLOW_RTS_PIN_H2);
+            gpio_reset_pin(FLOW_CTS_PIN_H2);
+            ESP_ERROR_CHECK(uart_set_pin(UART_NUM, TXD_PIN, RXD_PIN, RTS_PIN, CTS_PIN));
+        }
+    }
+    uart_flush_input(UART_NUM); // bytes received around the switch are garbage
+
+    uart_link_baud = baud_rate;
+    uart_link_flow_ctrl = flow_ctrl;
+    xSemaphoreGive(uart_tx_lock);
+
+    ESP_LOGW(TAG_B, "Uart link now %" PRIu32 " baud, flow control %s", baud_rate, flow_ctrl ? "on" : "off");
+}
+
+static void uart_baud_rollback_cb(void* arg) {
+    // runs in the esp_timer task, races uart_baud_confirm() from the rx task
+    if (!atomic_exchange(&uart_baud_pending, false)) {
+        return;
+    }
+
+    uart_link_apply(uart_prev_baud, uart_prev_flow_ctrl);
+    uart_sendMsg(0, "[E]BAUD-ROLLBACK");
+    uart_rx_credit_reset();
+}
+
+esp_err_t uart_baud_propose(uint32_t baud_rate, bool flow_ctrl) {
+    bool supported = false;
+    for (int i = 0; i < sizeof(uart_supported_bauds) / sizeof(uart_supported_bauds[0]); i++) {
+        if (uart_supported_bauds[i] == baud_rate) {
+            supported = true;
+            break;
         }
+    }
+
+    if (!supported) {
+        ESP_LOGE(TAG_B, "Unsupported baud rate %" PRIu32, baud_rate);
+        uart_sendMsg(0, "Error: Unsupported Baud Rate\n");
+        return ESP_ERR_INVALID_ARG;
+    } else if (atomic_load(&uart_baud_pending)) {
+        uart_sendMsg(0, "Error: Baud Rate Switch Pending\n");
+        return ESP_ERR_INVALID_STATE;
+    }
 
-        // nned 2 byte encoded
-        uint8_t encoded = byte_itr[0] ^ esacpe_byte; // bitwise Xor
-        uart_write_bytes(UART_NUM, &esacpe_byte, 1);
-        uart_write_bytes(UART_NUM, &encoded, 1);
-        byte_wrote += 2;
+    if (uart_baud_timer == NULL) {
+        const esp_timer_create_args_t baud_timer_args = {
+            .callback = &uart_baud_rollback_cb,
+            .name = "uart_baud"
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&baud_timer_args, &uart_baud_timer));
+    }
+
+    // ack at old baud rate, host switches after receiving it
+    uart_sendMsg(0, "[E]BAUD-OK");
+
+    uart_prev_baud = uart_link_baud;
+    uart_prev_flow_ctrl = uart_link_flow_ctrl;
+    atomic_store(&uart_baud_pending, true);
+    uart_link_apply(baud_rate, flow_ctrl);
+
+    ESP_ERROR_CHECK(esp_timer_start_once(uart_baud_timer, UART_BAUD_CONFIRM_TIMEOUT_US));
+    return ESP_OK;
+}
+
+esp_err_t uart_baud_confirm(void) {
+    // too late once the rollback claimed the switch
+    if (!atomic_exchange(&uart_baud_pending, false)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_timer_stop(uart_baud_timer);
+    uart_sendMsg(0, "[E]BAUD-CONFIRMED");
+    uart_rx_credit_reset(); // input flushed on the switch
+    return ESP_OK;
+}
+
+uint32_t uart_get_link_baud(void) {
+    return uart_link_baud;
+}
+
+int uart_write_encoded_bytes(uart_port_t uart_num, uint8_t* data, size_t length) {
+    uint8_t encoded[64];
+    const size_t chunk_size = sizeof(encoded) / 2;
+
+    int byte_wrote = 0;
+    for (size_t offset = 0; offset < length; offset += chunk_size) {
+        size_t chunk_length = (length - offset < chunk_size) ? length - offset : chunk_size;
+        size_t encoded_length = uart_encode_bytes(data + offset, chunk_length, encoded);
+        byte_wrote += uart_write_bytes(uart_num, encoded, encoded_length);
     }
 
     return byte_wrote;
 }
 
-// Able to wrote back to the same buffer, since decoded data is always shorter
-int uart_decoded_bytes(uint8_t* data, size_t length, uint8_t* decoded_data) {
-    int decoed_len = 0;
-    uint8_t* decode_itr = decoded_data;
+// Encode whole frame into one buffer and hand it to the driver in a single write
+static int uart_write_frame(uint16_t node_addr, const uint8_t* data, size_t length) {
+    if (uart_tx_lock == NULL) {
+        ESP_LOGE(TAG_B, "Uart not initialized, dropping %d bytes frame", (int) length);
+        return -1;
+    }
 
-    for (uint8_t* byte_itr = data; byte_itr < data + length; ++byte_itr) {
-        if (byte_itr[0] != ESCAPE_BYTE) {
-            // not a ESCAPE_BYTE
-            decode_itr[0] = byte_itr[0];
-            decode_itr += 1;
-            decoed_len += 1;
-            continue;
+    xSemaphoreTake(uart_tx_lock, portMAX_DELAY);
+
+    uint8_t* frame_buf = uart_tx_frame_buf;
+    size_t frame_buf_size = sizeof(uart_tx_frame_buf);
+    if (UART_FRAME_ENCODED_LEN(length) > frame_buf_size) {
+        // oversized payload, rare case so allocate instead of reserving a bigger static buffer
+        frame_buf_size = UART_FRAME_ENCODED_LEN(length);
+        frame_buf = (uint8_t*) malloc(frame_buf_size);
+        if (frame_buf == NULL) {
+            xSemaphoreGive(uart_tx_lock);
+            ESP_LOGE(TAG_B, "Failed to allocate %d bytes for uart frame", (int) frame_buf_size);
+            return -1;
         }
+    }
 
-        // ESCAPE_BYTE, decode 2 byte into 1
-        byte_itr += 1; // move to next to get encoded byte
-        uint8_t encoded = byte_itr[0];
-        
-        uint8_t decoded = encoded ^ ESCAPE_BYTE; // bitwise Xor
-        decode_itr[0] = decoded;
-        decode_itr += 1;
-        decoed_len += 1;
+    size_t frame_len = uart_build_frame(node_addr, data, length, frame_buf, frame_buf_size);
+    int txBytes = uart_write_bytes(UART_NUM, frame_buf, frame_len);
+    if (txBytes > 0) {
+        atomic_fetch_add(&uart_tx_bytes, txBytes);
     }
-    
-    return decoed_len;
+
+    if (frame_buf != uart_tx_frame_buf) {
+        free(frame_buf);
+    }
+    xSemaphoreGive(uart_tx_lock);
+
+    return txBytes;
 }
 
+static int uart_write_encoded_frame(const uint8_t* frame, size_t frame_len) {
+    xSemaphoreTake(uart_tx_lock, portMAX_DELAY);
+    int txBytes = uart_write_bytes(UART_NUM, frame, frame_len);
+    if (txBytes > 0) {
+        atomic_fetch_add(&uart_tx_bytes, txBytes);
+    }
+    xSemaphoreGive(uart_tx_lock);
+
+    return txBytes;
+}
 
-// TB Finish, need to encode the send data for escape bytes
 // do we need to regulate the message length?
 int uart_sendData(uint16_t node_addr, uint8_t* data, size_t length)
 {
@@ -272,42 +404,277 @@ int uart_sendData(uint16_t node_addr, uint8_t* data, size_t length)
     return length;
 #else
     // not enabled local_edge_device, pass message to uart with uart encoding
-    uint8_t uart_start = UART_START;
-    uint8_t uart_end = UART_END;
-    int txBytes = 0;
-
-    uint16_t node_addr_big_endian = htons(node_addr); 
-    txBytes += uart_write_bytes(UART_NUM, &uart_start, 1); // 0xFF
-    txBytes += uart_write_encoded_bytes(UART_NUM, (uint8_t*) &node_addr_big_endian, 2);
-    txBytes += uart_write_encoded_bytes(UART_NUM, data, length);
-    txBytes += uart_write_bytes(UART_NUM, &uart_end, 1);  // 0xFE
+    int txBytes = uart_write_frame(node_addr, data, length);
 
     ESP_LOGI("[UART]", "Wrote %d bytes Data on uart-tx", txBytes);
     return txBytes;
 #endif
 }
 
-// TB Finish, need to encode the send data for escape bytes
 int uart_sendMsg(uint16_t node_addr, char* msg)
 {
     size_t length = strlen(msg);
-    uint8_t uart_start = UART_START;
-    uint8_t uart_end = UART_END;
-    int txBytes = 0;
-
-    uint16_t node_addr_big_endian = htons(node_addr); 
-    txBytes += uart_write_bytes(UART_NUM, &uart_start, 1); // 0xFF
-    txBytes += uart_write_encoded_bytes(UART_NUM, (uint8_t*) &node_addr_big_endian, 2);
-    txBytes += uart_write_encoded_bytes(UART_NUM, (uint8_t*) msg, length);
-    txBytes += uart_write_bytes(UART_NUM, &uart_end, 1);  // 0xFE
+    int txBytes = uart_write_frame(node_addr, (uint8_t*) msg, length);
 
     ESP_LOGI("[UART]", "Wrote %d bytes Msg on uart-tx", txBytes);
     return txBytes;
 }
 
+#if !LOCAL_EDGE_DEVICE
+// wait for a free slot when keep is set, UART_TX_FULL_POLICY otherwise
+static int uart_tx_enqueue(uint16_t node_addr, uint8_t* data, size_t length, bool keep)
+{
+    if (uart_tx_queue_lock == NULL) {
+        ESP_LOGE(TAG_B, "Uart not initialized, dropping %d bytes frame", (int) length);
+        return -1;
+    } else if (length > UART_MAX_PAYLOAD_LEN) {
+        ESP_LOGE(TAG_B, "Payload %d bytes too long for uart tx queue, dropped", (int) length);
+        return -1;
+    }
+
+    // no uart write under it, only released early while UART_TX_FULL_BLOCK waits for a free slot
+    xSemaphoreTake(uart_tx_queue_lock, portMAX_DELAY);
+    unsigned head = atomic_load_explicit(&uart_tx_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&uart_tx_tail, memory_order_acquire);
+    if (head - tail >= UART_TX_QUEUE_LEN) {
+        uart_tx_stats.overflows += 1;
+    }
+
+    while (head - tail >= UART_TX_QUEUE_LEN) {
+        bool wait = keep || UART_TX_FULL_POLICY == UART_TX_FULL_BLOCK;
+#if UART_TX_FULL_POLICY == UART_TX_FULL_DROP_OLDEST
+        if (!wait && !uart_tx_slots[tail % UART_TX_QUEUE_LEN].keep) {
+            // fails if uart_tx_task claimed the oldest frame meanwhile, that frees the slot as well
+            if (atomic_compare_exchange_strong(&uart_tx_tail, &tail, tail + 1)) {
+                uart_tx_stats.dropped_oldest += 1;
+            }
+            tail = atomic_load_explicit(&uart_tx_tail, memory_order_acquire);
+            continue;
+        }
+#endif
+        if (!wait) {
+            // DROP_NEWEST, or DROP_OLDEST with a kept frame at the tail
+            uart_tx_stats.dropped_newest += 1;
+            xSemaphoreGive(uart_tx_queue_lock);
+            return -1;
+        }
+
+        // uart_sendEvent() and other producers go on meanwhile, head may have moved once retaken
+        xSemaphoreGive(uart_tx_queue_lock);
+        vTaskDelay(1);
+        xSemaphoreTake(uart_tx_queue_lock, portMAX_DELAY);
+        head = atomic_load_explicit(&uart_tx_head, memory_order_relaxed);
+        tail = atomic_load_explicit(&uart_tx_tail, memory_order_acquire);
+    }
+
+    uart_tx_slot_t* slot = &uart_tx_slots[head % UART_TX_QUEUE_LEN];
+    int frame_len = uart_build_frame(node_addr, data, length, slot->frame, sizeof(slot->frame));
+    slot->length = frame_len;
+    slot->keep = keep;
+    atomic_store_explicit(&uart_tx_head, head + 1, memory_order_release);
+    uart_tx_stats.enqueued += 1;
+    xSemaphoreGive(uart_tx_queue_lock);
+
+    // frames queued before board_init() go out once uart_tx_task starts
+    if (uart_tx_task_handle != NULL) {
+        xTaskNotifyGive(uart_tx_task_handle);
+    }
+    return frame_len;
+}
+#endif
+
+int uart_sendData_async(uint16_t node_addr, uint8_t* data, size_t length)
+{
+#if LOCAL_EDGE_DEVICE
+    return uart_sendData(node_addr, data, length);
+#else
+    return uart_tx_enqueue(node_addr, data, length, false);
+#endif
+}
+
+int uart_sendData_wait(uint16_t node_addr, uint8_t* data, size_t length)
+{
+#if LOCAL_EDGE_DEVICE
+    return uart_sendData(node_addr, data, length);
+#else
+    return uart_tx_enqueue(node_addr, data, length, true);
+#endif
+}
+
+int uart_sendEvent(uint16_t node_addr, uint8_t* data, size_t length)
+{
+#if LOCAL_EDGE_DEVICE
+    return uart_sendData(node_addr, data, length);
+#else
+    if (uart_tx_queue_lock == NULL) {
+        ESP_LOGE(TAG_B, "Uart not initialized, dropping %d bytes event", (int) length);
+        return -1;
+    } else if (length > UART_TX_EVT_MAX_PAYLOAD_LEN) {
+        ESP_LOGE(TAG_B, "Event %d bytes too long for uart event queue, dropped", (int) length);
+        return -1;
+    }
+
+    xSemaphoreTake(uart_tx_queue_lock, portMAX_DELAY);
+    unsigned head = atomic_load_explicit(&uart_tx_evt_head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&uart_tx_evt_tail, memory_order_acquire) >= UART_TX_EVT_QUEUE_LEN) {
+        uart_tx_stats.event_waits += 1;
+        // events aren't credit gated, uart_tx_task frees a slot within a frame time
+        do {
+            xSemaphoreGive(uart_tx_queue_lock);
+            vTaskDelay(1);
+            xSemaphoreTake(uart_tx_queue_lock, portMAX_DELAY);
+            head = atomic_load_explicit(&uart_tx_evt_head, memory_order_relaxed);
+        } while (head - atomic_load_explicit(&uart_tx_evt_tail, memory_order_acquire) >= UART_TX_EVT_QUEUE_LEN);
+    }
+
+    uart_tx_evt_slot_t* slot = &uart_tx_evt_slots[head % UART_TX_EVT_QUEUE_LEN];
+    int frame_len = uart_build_frame(node_addr, data, length, slot->frame, sizeof(slot->frame));
+    slot->length = frame_len;
+    atomic_store_explicit(&uart_tx_evt_head, head + 1, memory_order_release);
+    uart_tx_stats.events += 1;
+    xSemaphoreGive(uart_tx_queue_lock);
+
+    if (uart_tx_task_handle != NULL) {
+        xTaskNotifyGive(uart_tx_task_handle);
+    }
+    return frame_len;
+#endif
+}
+
+void uart_tx_get_stats(uart_tx_stats_t* stats)
+{
+    *stats = uart_tx_stats;
+}
+
+// credit frame to host: event code | flags | 4 byte rx bytes consumed | 2 byte rx window
+static void uart_rx_credit_send(uint8_t flags)
+{
+#if UART_CREDIT_FLOW && !LOCAL_EDGE_DEVICE
+    uint32_t consumed = atomic_load(&uart_rx_consumed);
+    uint8_t credit[8] = {UART_EVT_CREDIT, flags, consumed >> 24, (consumed >> 16) & 0xFF, (consumed >> 8) & 0xFF, consumed & 0xFF,
+        UART_RX_CREDIT_WINDOW >> 8, UART_RX_CREDIT_WINDOW & 0xFF};
+
+    atomic_store(&uart_rx_reported, consumed);
+    uart_write_frame(0, credit, sizeof(credit));
+#endif
+}
+
+void uart_rx_credit_return(size_t length)
+{
+    uint32_t consumed = atomic_fetch_add(&uart_rx_consumed, length) + length;
+    if (consumed - atomic_load(&uart_rx_reported) >= UART_RX_CREDIT_UPDATE_BYTES) {
+        uart_rx_credit_send(0);
+    }
+}
+
+void uart_rx_credit_reset(void)
+{
+    atomic_store(&uart_rx_consumed, 0);
+    uart_rx_credit_send(UART_CREDIT_FLAG_RESTART);
+}
+
+void uart_tx_credit_update(uint32_t host_consumed, uint16_t host_window, bool restart)
+{
+    if (restart) {
+        // bytes already on the way get counted by host as well, unread count goes negative and is taken as 0
+        xSemaphoreTake(uart_tx_lock, portMAX_DELAY);
+        atomic_store(&uart_tx_bytes, host_consumed);
+        xSemaphoreGive(uart_tx_lock);
+    }
+    atomic_store(&uart_host_consumed, host_consumed);
+    atomic_store(&uart_host_window, host_window);
+
+    if (uart_tx_task_handle != NULL) {
+        xTaskNotifyGive(uart_tx_task_handle);
+    }
+}
+
+// room on host for frame_len more bytes, always when host never sent a credit
+static bool uart_tx_credit_available(size_t frame_len)
+{
+    uint32_t window = atomic_load(&uart_host_window);
+    if (window == 0) {
+        return true;
+    }
+
+    int32_t unread = (int32_t) (atomic_load(&uart_tx_bytes) - atomic_load(&uart_host_consumed));
+    if (unread < 0) {
+        unread = 0;
+    }
+    return unread + frame_len <= window;
+}
+
+static void uart_tx_task(void *arg)
+{
+    static uint8_t frame[UART_TX_FRAME_BUF_SIZE];
+    int64_t credit_wait_us = 0; // when the head frame started waiting for host credit
+
+    while (1) {
+        unsigned evt_tail = atomic_load_explicit(&uart_tx_evt_tail, memory_order_relaxed);
+        if (evt_tail != atomic_load_explicit(&uart_tx_evt_head, memory_order_acquire)) {
+            // events first and regardless of host credit, the slot is only reused once tail moved on
+            uart_tx_evt_slot_t* evt_slot = &uart_tx_evt_slots[evt_tail % UART_TX_EVT_QUEUE_LEN];
+            uart_write_encoded_frame(evt_slot->frame, evt_slot->length);
+            atomic_store_explicit(&uart_tx_evt_tail, evt_tail + 1, memory_order_release);
+            continue;
+        }
+
+        unsigned tail = atomic_load_explicit(&uart_tx_tail, memory_order_acquire);
+        if (tail == atomic_load_explicit(&uart_tx_head, memory_order_acquire)) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        // copy first then claim, claim fails if producer dropped this frame while copying
+        uart_tx_slot_t* slot = &uart_tx_slots[tail % UART_TX_QUEUE_LEN];
+#if UART_CREDIT_FLOW
+        if (!uart_tx_credit_available(slot->length)) {
+            // producer keeps queuing meanwhile, UART_TX_FULL_POLICY applies once the queue is full
+            int64_t now = esp_timer_get_time();
+            if (credit_wait_us == 0) {
+                credit_wait_us = now;
+                uart_tx_stats.credit_waits += 1;
+            }
+            if (now - credit_wait_us < UART_TX_CREDIT_TIMEOUT_US) {
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(UART_TX_CREDIT_POLL_MS));
+                continue;
+            }
+            ESP_LOGW(TAG_B, "Host returned no uart credit in %d ms, no longer honoring its window", UART_TX_CREDIT_TIMEOUT_US / 1000);
+            atomic_store(&uart_host_window, 0);
+        }
+        credit_wait_us = 0;
+#endif
+        size_t frame_len = slot->length;
+        if (frame_len > sizeof(frame)) {
+            frame_len = sizeof(frame);
+        }
+        memcpy(frame, slot->frame, frame_len);
+
+        if (!atomic_compare_exchange_strong(&uart_tx_tail, &tail, tail + 1)) {
+            continue;
+        }
+
+        uart_write_encoded_frame(frame, frame_len);
+        uart_tx_stats.sent += 1;
+    }
+}
+
+static void uart_tx_queue_init(void)
+{
+#if !LOCAL_EDGE_DEVICE
+    uart_tx_queue_lock = xSemaphoreCreateMutex();
+    if (uart_tx_queue_lock == NULL) {
+        ESP_LOGE(TAG_B, "Failed to create uart tx queue lock");
+        return;
+    }
+    xTaskCreate(uart_tx_task, "uart_tx_task", 1024 * 2, NULL, configMAX_PRIORITIES - 2, &uart_tx_task_handle);
+#endif
+}
+
 void board_init(void)
 {
     uart_init();
+    uart_tx_queue_init();
     board_led_init();
     board_button_init();
 
@@ -15,6 +15,7 @@
 #include "led_strip_encoder.h"
 #include <arpa/inet.h>
 #include "../Secret/NetworkConfig.h"
+#include "uart_frame.h"
 
 // Dev mode send uart signal to usb-uart port
 // #define UART_NUM_H2 UART_NUM_0 // defult log port
@@ -30,14 +31,45 @@
 #define RXD_PIN     RX_PIN_H2
 #define RTS_PIN     UART_PIN_NO_CHANGE // not using
 #define CTS_PIN     UART_PIN_NO_CHANGE // not using
-#define UART_BAUD_RATE 115200
+#define FLOW_RTS_PIN_H2 2 // routed only when host enables rts/cts flow control
+#define FLOW_CTS_PIN_H2 3 // routed only when host enables rts/cts flow control
+#define UART_FLOW_CTRL_THRESH 122 // rx fifo level that deasserts rts
+#define UART_BAUD_RATE 115200 // boot baud rate, host can negotiate a higher one at runtime
+#define UART_BAUD_CONFIRM_TIMEOUT_US 2000000 // host must confirm a new baud rate within 2s, otherwise roll back
 #define UART_BUF_SIZE 1024
 
+// uart rx mode - polling reads with 1s timeout, or driver event queue with pattern detection on UART_END
+#define UART_RX_MODE_POLLING    0
+#define UART_RX_MODE_EVENT      1
+#define UART_RX_MODE            UART_RX_MODE_EVENT
+#define UART_EVENT_QUEUE_LEN    20
+#define UART_PATTERN_QUEUE_LEN  20 // max number of detected UART_END positions buffered in driver
+#define UART_LATENCY_TRACE      DISABLE // log time from uart rx to mesh send and rx_task stack margin for every command
+
+// uart tx queue - mesh callbacks only enqueue pre-encoded frames, uart_tx_task writes them to uart
+#define UART_TX_QUEUE_LEN           8
+#define UART_TX_FULL_BLOCK          0 // wait in the producer until uart_tx_task frees a slot
+#define UART_TX_FULL_DROP_OLDEST    1 // overwrite the oldest queued frame
+#define UART_TX_FULL_DROP_NEWEST    2 // discard the frame being enqueued
+#define UART_TX_FULL_POLICY         UART_TX_FULL_DROP_OLDEST
+// uart event queue - command replies and events to host, sent ahead of the tx queue, never dropped or held for credit
+#define UART_TX_EVT_QUEUE_LEN       16
+#define UART_TX_EVT_MAX_PAYLOAD_LEN 144 // largest event payload, a command report with its response message
+
+// uart credit flow control - both ends count every byte they read and write on the link, a side only sends while the
+// other end has fewer than window bytes unread, counts are cumulative so a lost credit frame is made up by the next one
+#define UART_CREDIT_FLOW            ENABLE
+#define UART_RX_CREDIT_WINDOW       (UART_BUF_SIZE * 2)         // bytes host may have in flight, uart rx ring size
+#define UART_RX_CREDIT_UPDATE_BYTES (UART_RX_CREDIT_WINDOW / 4) // report consumed bytes to host once this many more
+#define UART_TX_CREDIT_TIMEOUT_US   5000000 // host sent no credit for this long while tx waits, stop honoring its window
+#define UART_TX_CREDIT_POLL_MS      10
+#define UART_EVT_CREDIT             0xC6    // 1 byte flags | 4 byte rx bytes consumed | 2 byte rx window, to node addr 0
+#define UART_CREDIT_FLAG_RESTART    0x01    // count restarted, input before it was flushed
+
 #define BUTTON_IO_NUM           9
 #define BUTTON_ACTIVE_LEVEL     0
-#define ESCAPE_BYTE 0xFA
-#define UART_START 0xFF
-#define UART_END 0xFE
+
+#define UART_TX_FRAME_BUF_SIZE UART_FRAME_ENCODED_LEN(UART_MAX_PAYLOAD_LEN)
 
 enum State {
     DISCONNECTED,
@@ -46,6 +78,17 @@ enum State {
     WORKING,
 };
 
+typedef struct {
+    uint32_t enqueued;          // frames accepted into the tx queue
+    uint32_t sent;              // frames written to uart by uart_tx_task
+    uint32_t overflows;         // enqueue attempts that found the queue full
+    uint32_t dropped_oldest;    // queued frames discarded by UART_TX_FULL_DROP_OLDEST
+    uint32_t dropped_newest;    // new frames discarded by UART_TX_FULL_DROP_NEWEST, or by DROP_OLDEST when the oldest is kept
+    uint32_t credit_waits;      // frames held back until the host returned credit
+    uint32_t events;            // frames queued with uart_sendEvent()
+    uint32_t event_waits;       // uart_sendEvent() calls that waited for a free event slot
+} uart_tx_stats_t;
+
 /**
  * @brief Starts the timer.
  * 
@@ -104,6 +147,39 @@ void handleConnectionTimeout();
  */
 void board_init(void);
 
+/**
+ * @brief Get the uart driver event queue.
+ * 
+ * @return Event queue handle, NULL when UART_RX_MODE is not UART_RX_MODE_EVENT or uart is not initialized.
+ */
+QueueHandle_t uart_get_event_queue(void);
+
+/**
+ * @brief Switch uart link to a host proposed baud rate, pending confirmation.
+ * 
+ *  Replies "[E]BAUD-OK" at the current baud rate, then switches baud rate and optionally enables
+ *  RTS/CTS flow control on FLOW_RTS_PIN_H2/FLOW_CTS_PIN_H2. If uart_baud_confirm() is not called within
+ *  UART_BAUD_CONFIRM_TIMEOUT_US the previous settings, flow control pins included, are restored and
+ *  "[E]BAUD-ROLLBACK" is sent.
+ * 
+ * @param baud_rate Proposed baud rate.
+ * @param flow_ctrl Enable RTS/CTS hardware flow control.
+ * @return ESP_OK if switched, ESP_ERR_INVALID_ARG for unsupported rate, ESP_ERR_INVALID_STATE if a switch is pending.
+ */
+esp_err_t uart_baud_propose(uint32_t baud_rate, bool flow_ctrl);
+
+/**
+ * @brief Confirm the pending baud rate switch, keeping the new settings.
+ * 
+ * @return ESP_OK if confirmed, ESP_ERR_INVALID_STATE if no switch is pending or it was already rolled back.
+ */
+esp_err_t uart_baud_confirm(void);
+
+/**
+ * @brief Get the current uart link baud rate.
+ */
+uint32_t uart_get_link_baud(void);
+
 /**
  * @brief Operate the board's LED with specified RGB values.
  * 
@@ -124,24 +200,86 @@ void board_led_operation(uint8_t r, uint8_t g, uint8_t b);
 int uart_write_encoded_bytes(uart_port_t uart_num, uint8_t* data, size_t length);
 
 /**
- * @brief Decode bytes from the provided data.
+ * @brief Send data to a specific node address over UART.
  * 
- * @param data Pointer to the encoded data.
- * @param length Length of the encoded data.
- * @param decoded_data Pointer to the buffer for the decoded data.
- * @return Status of the decode operation.
+ * @param node_addr Node address to send the data to.
+ * @param data Pointer to the data to be sent.
+ * @param length Length of the data.
+ * @return Status of the send operation.
  */
-int uart_decoded_bytes(uint8_t* data, size_t length, uint8_t* decoded_data);
+int uart_sendData(uint16_t node_addr, uint8_t* data, size_t length);
 
 /**
- * @brief Send data to a specific node address over UART.
+ * @brief Queue data to a specific node address for sending over UART by the uart tx task.
+ * 
+ *  Meant for the BLE mesh callbacks so a slow uart never stalls the mesh stack. Any task can queue,
+ *  producers only hold a short lock while the frame is encoded into its slot. When the queue is full
+ *  UART_TX_FULL_POLICY applies. A payload above UART_MAX_PAYLOAD_LEN is dropped with an error.
  * 
  * @param node_addr Node address to send the data to.
  * @param data Pointer to the data to be sent.
  * @param length Length of the data.
- * @return Status of the send operation.
+ * @return Encoded frame length queued, -1 if the frame was dropped or uart is not initialized.
  */
-int uart_sendData(uint16_t node_addr, uint8_t* data, size_t length);
+int uart_sendData_async(uint16_t node_addr, uint8_t* data, size_t length);
+
+/**
+ * @brief Queue data like uart_sendData_async(), but never drop it.
+ * 
+ *  When the queue is full the caller waits for a free slot whatever UART_TX_FULL_POLICY is, and the frame is
+ *  not dropped as the oldest one by later producers. It still goes out only while the host has credit. Meant
+ *  for frames a host can't miss, like the chunks of a large message.
+ * 
+ * @param node_addr Node address to send the data to.
+ * @param data Pointer to the data to be sent.
+ * @param length Length of the data.
+ * @return Encoded frame length queued, -1 if the payload is too long or uart is not initialized.
+ */
+int uart_sendData_wait(uint16_t node_addr, uint8_t* data, size_t length);
+
+/**
+ * @brief Queue a command reply or event for the uart tx task, ahead of frames from uart_sendData_async().
+ * 
+ *  Any task can queue, events go out in the order they were queued. They are never dropped and never wait for
+ *  host credit, when the event queue is full the caller waits for a free slot instead.
+ * 
+ * @param node_addr Node address carried in the frame, 0 for module events.
+ * @param data Pointer to the event.
+ * @param length Length of the event, at most UART_TX_EVT_MAX_PAYLOAD_LEN.
+ * @return Encoded frame length queued, -1 if the event is too long or uart is not initialized.
+ */
+int uart_sendEvent(uint16_t node_addr, uint8_t* data, size_t length);
+
+/**
+ * @brief Return uart rx credits for bytes drained from the driver and executed.
+ * 
+ *  Sends the host UART_EVT_CREDIT once UART_RX_CREDIT_UPDATE_BYTES were returned since the last one, so a host that
+ *  stays within UART_RX_CREDIT_WINDOW never overruns the rx ring.
+ * 
+ * @param length Number of bytes read from the driver and fed to the parser.
+ */
+void uart_rx_credit_return(size_t length);
+
+/**
+ * @brief Restart the uart rx byte count after input was flushed, tells host with UART_CREDIT_FLAG_RESTART.
+ */
+void uart_rx_credit_reset(void);
+
+/**
+ * @brief Apply a host credit, frames queued with uart_sendData_async() only go out while the host has room.
+ * 
+ * @param host_consumed Bytes the host read from the link so far.
+ * @param host_window Bytes the host can buffer, 0 stops honoring credits.
+ * @param restart Host restarted its count, bytes written before are not waited on.
+ */
+void uart_tx_credit_update(uint32_t host_consumed, uint16_t host_window, bool restart);
+
+/**
+ * @brief Get a snapshot of the uart tx queue counters.
+ * 
+ * @param stats Pointer to the struct to fill.
+ */
+void uart_tx_get_stats(uart_tx_stats_t* stats);
 
 /**
  * @brief Send a message to a specific node address over UART.
@@ -2,14 +2,18 @@
 #include "esp_log.h"
 #include "iot_button.h"
 #include <string.h>
+#include <inttypes.h>
 #include <time.h>
 #include <arpa/inet.h>
 #include "esp_timer.h"
+#include "board.h"
+#include "ble_mesh_config_edge.h"
+#include "local_edge_device.h"
+#include "telemetry.h"
 #include "../Secret/NetworkConfig.h"
 
 #define MAX_MSG_LEN 256
 #define BLE_CMD_LEN 5
-#define BLE_ADDR_LEN 2
 #define TAG_L "[Local Edge]"
 
 esp_timer_handle_t data_send_timer;
@@ -20,45 +24,54 @@ bool sending_data = false;
 
 extern void execute_network_command(char *command, size_t cmd_total_len);
 
-void dispatch_network_command(char* ble_cmd, uint16_t node_addr, uint8_t *data_buffer, size_t data_length)
+// completion of messages to root, sent is the last report for normal messages
+static void ble_send_to_root_done(const mesh_send_result_t *result, void *user_ctx)
 {
-    uint8_t command_msg[MAX_MSG_LEN + BLE_CMD_LEN + BLE_ADDR_LEN];
-    memset(command_msg, 0, MAX_MSG_LEN + BLE_CMD_LEN + BLE_ADDR_LEN);
-    uint8_t *msg_itr = command_msg;
-    uint16_t node_addr_network_order = htons(node_addr);
+    if (result->status == MESH_SEND_FAILED)
+    {
+        ESP_LOGW(TAG_L, "Message %" PRIu32 " to root failed, err_code %d", result->handle, result->err_code);
+    }
+    else if (result->status == MESH_SEND_UNKNOWN)
+    {
+        ESP_LOGW(TAG_L, "Message %" PRIu32 " to root may not have been sent", result->handle);
+    }
+}
 
+void ble_send_to_root(uint8_t *data_buffer, size_t data_length)
+{
     if (data_length > MAX_MSG_LEN)
     {
         ESP_LOGE(TAG_L, "Local Edge Device Trying to Send %d bytes message that's more than MAX_MSG_LEN-%d", (int) data_length, (int) MAX_MSG_LEN);
         return;
     }
 
-    memcpy(msg_itr, ble_cmd, BLE_CMD_LEN);
-    msg_itr += BLE_CMD_LEN;
-    memcpy(msg_itr, &node_addr_network_order, BLE_ADDR_LEN);
-    msg_itr += BLE_ADDR_LEN;
-
-    if (data_buffer != NULL) {
-        memcpy(msg_itr, data_buffer, data_length);
-        msg_itr += data_length;
-    }
-
-    ESP_LOGI(TAG_L, "data_buffer: '%.*s'", data_length, data_buffer);
-    execute_network_command((char *) command_msg, msg_itr - command_msg);
+    ESP_LOGD(TAG_L, "data_buffer: '%.*s'", data_length, data_buffer);
+    mesh_send_async(PROV_OWN_ADDR, data_length, data_buffer, MESH_DELIVERY_NORMAL, ble_send_to_root_done, NULL, NULL);
 }
 
-void ble_send_to_root(uint8_t *data_buffer, size_t data_length)
+void reset_from_local_edge_device()
 {
-    char ble_cmd[7] = "SEND-";
-    ESP_LOGI(TAG_L, "data_buffer: '%.*s'", data_length, data_buffer);
-    dispatch_network_command(ble_cmd, 0, data_buffer, data_length);
+    char ble_cmd[7] = "RST-E";
+    execute_network_command(ble_cmd, BLE_CMD_LEN);
 }
 
 void sendtMultipleData_Example(int16_t *fake_gps)
 {
+    static uint8_t sequence_number = 0;
+
+#if TELEMETRY_ENCODING == TELEMETRY_ENCODING_DELTA
+    // fields: sequence_number | GPS x | GPS y | GPS z, encoded as delta against last acked keyframe, see telemetry.h
+    static telemetry_stream_t gps_stream;
+    if (gps_stream.dst_address == 0) {
+        telemetry_stream_init(&gps_stream, PROV_OWN_ADDR, 4);
+    }
+
+    int32_t fields[4] = {sequence_number, fake_gps[0], fake_gps[0], fake_gps[0]};
+    telemetry_add_fields(&gps_stream, fields);
+#else
     // Data update opcode | data_type_byte | data
     // D | 0x00 | sequence_number_1_byte | 0x01 | GPS_6_bytes
-    static uint8_t sequence_number = 0;
+    // buffered and sent to root batched with other samples, see telemetry.h
     uint8_t buffer[MAX_MSG_LEN];
     uint8_t *buf_itr = buffer;
 
@@ -90,7 +103,8 @@ void sendtMultipleData_Example(int16_t *fake_gps)
     memcpy(buf_itr, fake_gps, 2);
     buf_itr += 2;
 
-    ble_send_to_root(buffer, buf_itr - buffer);
+    telemetry_add_sample(PROV_OWN_ADDR, buffer, buf_itr - buffer);
+#endif
     sequence_number += 1;
 }
 
@@ -143,6 +157,7 @@ void stop_data_send_event() {
         return;
     }
     ESP_ERROR_CHECK(esp_timer_stop(data_send_timer));
+    telemetry_flush(PROV_OWN_ADDR); // don't hold back the last samples
     sending_data = false;
 }
 
@@ -152,8 +167,7 @@ void start_current_test(char* current_test) {
     if (strncmp(current_test, "0", 1) == 0)
     {
         // restart module
-        char ble_cmd[7] = "RST-E";
-        dispatch_network_command(ble_cmd, 0, NULL, 0);
+        reset_from_local_edge_device();
     }
     else if (strncmp(current_test, "D", 1) == 0)
     {
@@ -229,8 +243,7 @@ void local_edge_device_network_message_handler(uint16_t node_addr, uint8_t *data
     else if ((strncmp(opcode, "S", OPCODE_LEN) == 0))
     {
         ESP_LOGW(TAG_L, "Resetting");
-        char ble_cmd[7] = "RST-E";
-        dispatch_network_command(ble_cmd, 0, NULL, 0);
+        reset_from_local_edge_device();
     }
     else if (strncmp(opcode, "E", OPCODE_LEN) == 0)
     {
@@ -252,6 +265,8 @@ void local_edge_device_network_message_handler(uint16_t node_addr, uint8_t *data
 // }
 
 void local_edge_device_init() {
+    ESP_ERROR_CHECK(telemetry_init());
+
     // any logic need to be on its thread for local edge device to run
     // xTaskCreate(local_edge_device_task, "local_edge_device_task", 1024 * 2, NULL, configMAX_PRIORITIES - 2, NULL);
 }
\ No newline at end of file
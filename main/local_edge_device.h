@@ -0,0 +1,40 @@
+/* local_edge_device.h - Edge device logic integrated in DevKit module */
+
+#ifndef _LOCAL_EDGE_DEVICE_H_
+#define _LOCAL_EDGE_DEVICE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Initialize the local edge device.
+ */
+void local_edge_device_init();
+
+/**
+ * @brief Handle a network message addressed to the local edge device.
+ * 
+ *  Used in place of the uart channel when LOCAL_EDGE_DEVICE is enabled.
+ * 
+ * @param node_addr Address of the node the message came from.
+ * @param data Pointer to the message.
+ * @param length Length of the message.
+ */
+void local_edge_device_network_message_handler(uint16_t node_addr, uint8_t *data, size_t length);
+
+/**
+ * @brief Start sending data to root periodically.
+ */
+void create_data_send_event();
+
+/**
+ * @brief Stop sending data to root periodically.
+ */
+void stop_data_send_event();
+
+/**
+ * @brief Send a robot request to root.
+ */
+void sendRobotRequest();
+
+#endif /* _LOCAL_EDGE_DEVICE_H_ */
@@ -1,5 +1,6 @@
 #include "board.h"
 #include "time.h"
+#include "esp_timer.h"
 #include "ble_mesh_config_edge.h"
 #include "../Secret/NetworkConfig.h"
 
@@ -9,10 +10,107 @@
 #define CMD_SEND_MSG "SEND-"
 #define CMD_BROADCAST_MSG "BCAST"
 #define CMD_RESET_EDGE "RST-E"
+#define CMD_BAUD_PROPOSE "BAUD-"
+#define CMD_BAUD_CONFIRM "BAUDC"
+
+// binary command - 1 byte opcode | 1 byte flags | 2 byte payload length (big endian) | payload
+#define UART_CMD_HEADER_LEN     4
+#define UART_OP_SEND            0x01 // 2 byte dst addr | message
+#define UART_OP_BROADCAST       0x02 // message
+#define UART_OP_RESET_EDGE      0x03 // -
+#define UART_OP_BAUD_PROPOSE    0x04 // 4 byte baud rate | optional 1 byte flags, bit 0 enables rts/cts
+#define UART_OP_BAUD_CONFIRM    0x05 // -
+#define UART_OP_SEND_BATCH      0x06 // 1 byte count | count * (2 byte dst addr | 1 byte length | message)
+                                     // or with UART_CMD_FLAG_SHARED: 1 byte count | count * 2 byte dst addr | message
+#define UART_OP_SEND_LARGE      0x07 // 2 byte dst addr | 2 byte total length | 2 byte offset | chunk, chunks in order
+#define UART_OP_DEDUP_STATS     0x08 // -
+#define UART_OP_GROUP_SUB       0x09 // 2 byte group addr
+#define UART_OP_GROUP_UNSUB     0x0A // 2 byte group addr
+#define UART_OP_GROUP_SEND      0x0B // 2 byte group addr | message
+#define UART_OP_SEND_STATS      0x0C // -
+#define UART_OP_CREDIT          0x0D // 4 byte bytes read from the link | 2 byte bytes host can buffer
+#define UART_OP_HEARTBEAT_STATS 0x0E // -
+#define UART_OP_MAX             0x40 // first byte below this is a binary opcode, ascii commands start with 'A'-'Z'
+
+#define UART_CMD_FLAG_RESPONSE  0x01 // UART_OP_SEND(_BATCH): message requires response from dst node
+#define UART_CMD_FLAG_SHARED    0x02 // UART_OP_SEND_BATCH: one message for every address
+#define UART_CMD_FLAG_CONTROL   0x04 // UART_OP_SEND(_BATCH): unacknowledged control message, sent ahead of queued messages
+#define UART_CMD_FLAG_REPORT    0x08 // UART_OP_SEND: reply opcode | 1 byte status (0 queued, 1 failed) | 1 byte segmented
+#define UART_CMD_FLAG_ID        0x10 // payload starts with 2 byte command id, UART_OP_SEND(_BATCH), UART_OP_BROADCAST and
+                                     // UART_OP_GROUP_SEND report completion with UART_EVT_CMD_DONE, batch record i as id + i
+#define UART_CMD_ID_LEN         2
+#define UART_CMD_FLAG_RESTART   0x20 // UART_OP_CREDIT: host restarted its byte count
+
+// binary response to host (node addr 0) - 1 byte (opcode | UART_RSP_FLAG) | response payload
+#define UART_RSP_FLAG           0x80
+#define UART_BATCH_OK           0x00
+#define UART_BATCH_SEND_FAILED  0x01
+#define UART_BATCH_MALFORMED    0x02 // record truncated, not sent
+#define UART_LARGE_STORED       0x00 // chunk stored, send the next one
+#define UART_LARGE_STARTED      0x01 // last chunk stored, transfer to node started
+#define UART_LARGE_SEND_FAILED  0x02 // transfer not started, another one in flight or send queue full
+#define UART_LARGE_MALFORMED    0x03 // bad length or chunk out of order, start over at offset 0
+#define UART_GROUP_OK           0x00
+#define UART_GROUP_FAILED       0x01 // not a group address or subscription list full
+
+// binary event to host (node addr 0), not a reply to a command - 1 byte event code | event payload
+#define UART_EVT_BACKPRESSURE   0xC1 // 1 byte state (1 slow down, 0 resume) | 1 byte queued messages
+#define UART_EVT_LARGE_DONE     0xC2 // 2 byte dst addr | 1 byte result (1 delivered, 0 failed)
+#define UART_EVT_LARGE_RECV     0xC3 // 2 byte src addr | 2 byte total length | 2 byte offset | chunk
+#define UART_LARGE_CHUNK_HDR_LEN 7
+#define UART_EVT_GROUP_MSG      0xC4 // 2 byte group addr | 2 byte src addr | message
+#define UART_EVT_CMD_DONE       0xC5 // 2 byte command id | 1 byte status | 2 byte err code | response message when acked
+#define UART_CMD_DONE_HDR_LEN   6
+#define UART_CMD_DONE_MAX_RSP   128  // longer response reported as acked without the message
+#define UART_CMD_SENT           0x00 // last report unless UART_CMD_FLAG_RESPONSE was set
+#define UART_CMD_ACKED          0x01 // response received
+#define UART_CMD_TIMEOUT        0x02 // no response
+#define UART_CMD_FAILED         0x03 // not sent, err code from the mesh stack
+#define UART_CMD_UNKNOWN        0x04 // stack never reported send complete, may have gone out, don't blindly resend
+// UART_EVT_CREDIT 0xC6 sent by board.c, see board.h
+_Static_assert(UART_CMD_DONE_HDR_LEN + UART_CMD_DONE_MAX_RSP <= UART_TX_EVT_MAX_PAYLOAD_LEN, "command report must fit a uart event");
+
+static const uint8_t uart_cmd_status[] = {
+    [MESH_SEND_SENT]    = UART_CMD_SENT,
+    [MESH_SEND_ACKED]   = UART_CMD_ACKED,
+    [MESH_SEND_TIMEOUT] = UART_CMD_TIMEOUT,
+    [MESH_SEND_FAILED]  = UART_CMD_FAILED,
+    [MESH_SEND_UNKNOWN] = UART_CMD_UNKNOWN,
+};
+
+typedef void (*uart_cmd_handler_t)(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length);
+
+typedef struct {
+    uart_cmd_handler_t handler;
+    size_t min_len; // minimum payload length
+} uart_cmd_entry_t;
 
 uint16_t node_own_addr = 0;
 
 /***************** Event Handler *****************/
+// forward a large message to host in chunks through the uart tx queue, waiting for room so no chunk is dropped
+static void forward_large_message(uint16_t node_addr, uint8_t *msg_ptr, uint16_t length) {
+    static uint8_t chunk[UART_MAX_PAYLOAD_LEN];
+    uint16_t chunk_len = 0;
+
+    for (uint16_t offset = 0; offset < length; offset += chunk_len) {
+        chunk_len = length - offset;
+        if (chunk_len > UART_MAX_PAYLOAD_LEN - UART_LARGE_CHUNK_HDR_LEN) {
+            chunk_len = UART_MAX_PAYLOAD_LEN - UART_LARGE_CHUNK_HDR_LEN;
+        }
+
+        chunk[0] = UART_EVT_LARGE_RECV;
+        chunk[1] = node_addr >> 8;
+        chunk[2] = node_addr & 0xFF;
+        chunk[3] = length >> 8;
+        chunk[4] = length & 0xFF;
+        chunk[5] = offset >> 8;
+        chunk[6] = offset & 0xFF;
+        memcpy(chunk + UART_LARGE_CHUNK_HDR_LEN, msg_ptr + offset, chunk_len);
+        uart_sendData_wait(0, chunk, UART_LARGE_CHUNK_HDR_LEN + chunk_len);
+    }
+}
+
 // prov_complete_handler() get triger when a new node is provitioned to the network
 static void prov_complete_handler(uint16_t node_index, const esp_ble_mesh_octet16_t uuid, uint16_t addr, uint8_t element_num, uint16_t net_idx) {
     ESP_LOGI(TAG_M, " ----------- prov_complete handler trigered -----------");
@@ -39,8 +137,14 @@ static void recv_message_handler(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, u
     setTimeout(false); // clear edge reset timeout
     // stop_timer();
 
-    // recived a ble-message from edge ndoe
-    uart_sendData(node_addr, msg_ptr, length);
+    if (opcode == ECS_193_MODEL_OP_FRAG) {
+        // reassembled large message, doesn't fit one uart frame
+        forward_large_message(node_addr, msg_ptr, length);
+        return;
+    }
+
+    // recived a ble-message from edge ndoe, queued so uart speed never stalls mesh stack
+    uart_sendData_async(node_addr, msg_ptr, length);
 
     // clear edge reset timeout
     #if TIMEOUT_TIMER
@@ -49,8 +153,8 @@ static void recv_message_handler(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, u
     // stop_timer();
 
     // check if needs an response to confirm recived
-    if (opcode == ECS_193_MODEL_OP_MESSAGE) {
-        // only normal message no need for response
+    if (opcode == ECS_193_MODEL_OP_MESSAGE || opcode == ECS_193_MODEL_OP_MESSAGE_I || opcode == ECS_193_MODEL_OP_MESSAGE_IC) {
+        // normal message no need for response, important message already acked by sequence in network module
         return;
     }
 
@@ -71,27 +175,12 @@ static void recv_response_handler(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length,
         setTimeout(false);
     #endif
     // stop_timer();
-
-    // clear confirmed recived important message
-    int8_t index = get_important_message_index(opcode);
-    if (index != -1) {
-        // resend the important message
-        ESP_LOGW(TAG_M, "Confirm delivered on Important Message, index: %d", index);
-        clear_important_message(index);
-    }
 }
 
 // timeout_handler() get triger when module previously sent an message that requires response but didn't receive response
 static void timeout_handler(esp_ble_mesh_msg_ctx_t *ctx, uint32_t opcode) {
     ESP_LOGI(TAG_M, " ----------- timeout handler trigered -----------");
 
-    // cehck for retransmition
-    int8_t index = get_important_message_index(opcode);
-    if (index != -1) {
-        // resend the important message
-        retransmit_important_message(ctx, opcode, index);
-    }
-
     // check for edge restart when mutiple timeout happened
     // Print the current value of timeout
     #if TIMEOUT_TIMER
@@ -110,9 +199,26 @@ static void broadcast_handler(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, uint
     uint16_t node_addr = ctx->addr;
     ESP_LOGE(TAG_M, "-> Received Broadcast Message \'%*s\' from node-%d", length, (char *) msg_ptr, node_addr);
 
+    if (ESP_BLE_MESH_ADDR_IS_GROUP(ctx->recv_dst)) {
+        // group message, host needs the group to tell topics apart
+        static uint8_t event[UART_MAX_PAYLOAD_LEN];
+        if (length > UART_MAX_PAYLOAD_LEN - 5) {
+            ESP_LOGE(TAG_M, "Group message %d bytes too long for uart", length);
+            return;
+        }
+        event[0] = UART_EVT_GROUP_MSG;
+        event[1] = ctx->recv_dst >> 8;
+        event[2] = ctx->recv_dst & 0xFF;
+        event[3] = node_addr >> 8;
+        event[4] = node_addr & 0xFF;
+        memcpy(event + 5, msg_ptr, length);
+        uart_sendData_async(0, event, 5 + length);
+        return;
+    }
+
     // ========== General case, pass up to APP level ==========
     // pass node_addr & data to to edge device using uart
-    uart_sendData(node_addr, msg_ptr, length);
+    uart_sendData_async(node_addr, msg_ptr, length);
 }
 
 // connectivity_handler() get triger when module recived an connectivity check message (heartbeat message)
@@ -124,14 +230,381 @@ static void connectivity_handler(esp_ble_mesh_msg_ctx_t *ctx, uint16_t length, u
     send_response(ctx, response_length, (uint8_t *)response, ECS_193_MODEL_OP_CONNECTIVITY);
 }
 
+// important_failed_handler() get triger when an important message was never acked and the module gave up retransmitting
+static void important_failed_handler(uint16_t dst_address, uint16_t length, uint8_t *msg_ptr) {
+    ESP_LOGE(TAG_M, "Important Message \'%.*s\' to node-%d undelivered", length, (char *) msg_ptr, dst_address);
+    char message[] = "Error: Important Message Undelivered\n";
+    uart_sendEvent(0, (uint8_t *) message, strlen(message));
+
+    #if TIMEOUT_TIMER
+        handleConnectionTimeout();
+    #endif
+}
+
+// backpressure_handler() get triger when the mesh send queue fills up or drains, tells uart host to slow down or resume
+static void backpressure_handler(bool congested, uint16_t queued) {
+    uint8_t event[3] = {UART_EVT_BACKPRESSURE, congested, queued};
+    uart_sendEvent(0, event, sizeof(event));
+}
+
 /***************** Other Functions *****************/
-static void execute_uart_command(char *command, size_t cmd_total_len) {
+static const char *TAG_E = "EXE";
+
+static uint16_t read_be16(const uint8_t *data) {
+    return (uint16_t) ((data[0] << 8) | data[1]);
+}
+
+static uint32_t read_be32(const uint8_t *data) {
+    return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3];
+}
+
+static uint8_t* write_be32(uint8_t *data, uint32_t value) {
+    data[0] = value >> 24;
+    data[1] = (value >> 16) & 0xFF;
+    data[2] = (value >> 8) & 0xFF;
+    data[3] = value & 0xFF;
+    return data + 4;
+}
+
+// report one command to host: id | status | err code | response message
+static void uart_cmd_send_done(uint16_t cmd_id, uint8_t status, int err_code, uint8_t *msg_ptr, uint16_t length) {
+    // on the stack, reported from btc, mesh_tx, esp_timer and uart rx task alike
+    uint8_t event[UART_CMD_DONE_HDR_LEN + UART_CMD_DONE_MAX_RSP];
+    if (length > UART_CMD_DONE_MAX_RSP) {
+        ESP_LOGW(TAG_M, "Response %d bytes to command %d too long for report", length, cmd_id);
+        length = 0;
+    }
+
+    event[0] = UART_EVT_CMD_DONE;
+    event[1] = cmd_id >> 8;
+    event[2] = cmd_id & 0xFF;
+    event[3] = status;
+    event[4] = (uint16_t) err_code >> 8;
+    event[5] = (uint16_t) err_code & 0xFF;
+    if (length > 0) {
+        memcpy(event + UART_CMD_DONE_HDR_LEN, msg_ptr, length);
+    }
+    // event queue is shared by every task and never drops, so each id gets its last report and reports keep their order
+    uart_sendEvent(0, event, UART_CMD_DONE_HDR_LEN + length);
+}
+
+// mesh_send_async() completion of a host command, user_ctx holds the command id
+static void uart_cmd_done(const mesh_send_result_t *result, void *user_ctx) {
+    uart_cmd_send_done((uint16_t) (uintptr_t) user_ctx, uart_cmd_status[result->status], result->err_code, result->msg_ptr, result->length);
+}
+
+static esp_err_t command_send(uint16_t node_addr, uint8_t *msg_start, size_t msg_length, uint8_t cmd_flags, uint16_t cmd_id) {
+    esp_err_t err = ESP_OK;
+    if (node_addr == 0) {
+        node_addr = PROV_OWN_ADDR; // root addr
+    }
+
+    ESP_LOGI(TAG_E, "Sending message to address-%d ...", node_addr);
+    if (cmd_flags & UART_CMD_FLAG_ID) {
+        mesh_delivery_class_t delivery_class = MESH_DELIVERY_NORMAL;
+        if (cmd_flags & UART_CMD_FLAG_CONTROL) {
+            delivery_class = MESH_DELIVERY_CONTROL;
+        } else if (cmd_flags & UART_CMD_FLAG_RESPONSE) {
+            delivery_class = MESH_DELIVERY_RESPONSE;
+        }
+
+        err = mesh_send_async(node_addr, msg_length, msg_start, delivery_class, uart_cmd_done, (void *) (uintptr_t) cmd_id, NULL);
+        if (err != ESP_OK) {
+            uart_cmd_send_done(cmd_id, UART_CMD_FAILED, err, NULL, 0);
+        }
+    } else if (cmd_flags & UART_CMD_FLAG_CONTROL) {
+        err = send_control_message(node_addr, msg_length, msg_start);
+    } else {
+        err = send_message(node_addr, msg_length, msg_start, cmd_flags & UART_CMD_FLAG_RESPONSE);
+    }
+    ESP_LOGW(TAG_M, "<- Sended Message \'%.*s\' to node-%d", msg_length, (char*) msg_start, node_addr);
+    return err;
+}
+
+static void command_reset_edge() {
+    // restart edge module
+    setNodeState(DISCONNECTED);
+    reset_edge();
+}
+
+static void command_baud_confirm() {
+    if (uart_baud_confirm() != ESP_OK) {
+        uart_sendMsg(0, "Error: No Baud Rate Switch Pending\n");
+    }
+}
+
+// ====== binary commands, one handler per opcode ======
+static void uart_op_send(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    uint16_t node_addr = read_be16(payload);
+    esp_err_t err = command_send(node_addr, payload + NODE_ADDR_LEN, length - NODE_ADDR_LEN, flags, cmd_id);
+
+    if (flags & UART_CMD_FLAG_REPORT) {
+        // response required and control messages have no extra header, same size budget as normal ones
+        uint8_t report[3] = {UART_OP_SEND | UART_RSP_FLAG, err != ESP_OK, mesh_send_is_segmented(MESH_DELIVERY_NORMAL, length - NODE_ADDR_LEN)};
+        uart_sendData(0, report, sizeof(report));
+    }
+}
+
+static void uart_op_broadcast(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    if (!(flags & UART_CMD_FLAG_ID)) {
+        broadcast_message(length, payload);
+        return;
+    }
+
+    esp_err_t err = mesh_send_async(0xFFFF, length, payload, MESH_DELIVERY_BROADCAST, uart_cmd_done, (void *) (uintptr_t) cmd_id, NULL);
+    if (err != ESP_OK) {
+        uart_cmd_send_done(cmd_id, UART_CMD_FAILED, err, NULL, 0);
+    }
+}
+
+static void uart_op_reset_edge(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    command_reset_edge();
+}
+
+static void uart_op_baud_propose(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    bool flow_ctrl = length > 4 && (payload[4] & 0x01);
+    uart_baud_propose(read_be32(payload), flow_ctrl);
+}
+
+static void uart_op_baud_confirm(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    command_baud_confirm();
+}
+
+// fan out one frame to many nodes, reply with one status frame: opcode | count | ok count | status per record
+static void uart_op_send_batch(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    uint8_t count = payload[0];
+    static uint8_t status[3 + UINT8_MAX]; // only called from rx_task, kept off its stack
+    uint8_t ok_count = 0;
+    uint8_t *record_itr = payload + 1;
+    uint8_t *payload_end = payload + length;
+
+    // NULL when the shared message is missing, every record is then malformed
+    uint8_t *shared_msg = NULL;
+    if ((flags & UART_CMD_FLAG_SHARED) && record_itr + count * NODE_ADDR_LEN < payload_end) {
+        shared_msg = record_itr + count * NODE_ADDR_LEN;
+    }
+
+    for (int i = 0; i < count; i++) {
+        uint8_t *msg_start = NULL;
+        size_t msg_length = 0;
+
+        if (flags & UART_CMD_FLAG_SHARED) {
+            msg_start = shared_msg;
+            msg_length = shared_msg != NULL ? payload_end - shared_msg : 0;
+        } else if (record_itr + NODE_ADDR_LEN + 1 <= payload_end) {
+            msg_start = record_itr + NODE_ADDR_LEN + 1;
+            msg_length = record_itr[NODE_ADDR_LEN];
+        }
+
+        if (msg_start == NULL || msg_length == 0 || msg_start + msg_length > payload_end) {
+            // rest of the records can't be located either, their ids still get a last report
+            for (; i < count; i++) {
+                status[3 + i] = UART_BATCH_MALFORMED;
+                if (flags & UART_CMD_FLAG_ID) {
+                    uart_cmd_send_done(cmd_id + i, UART_CMD_FAILED, ESP_ERR_INVALID_SIZE, NULL, 0);
+                }
+            }
+            break;
+        }
+
+        esp_err_t err = command_send(read_be16(record_itr), msg_start, msg_length, flags, cmd_id + i);
+        status[3 + i] = (err == ESP_OK) ? UART_BATCH_OK : UART_BATCH_SEND_FAILED;
+        ok_count += (err == ESP_OK);
+
+        record_itr = (flags & UART_CMD_FLAG_SHARED) ? record_itr + NODE_ADDR_LEN : msg_start + msg_length;
+    }
+
+    status[0] = UART_OP_SEND_BATCH | UART_RSP_FLAG;
+    status[1] = count;
+    status[2] = ok_count;
+    uart_sendData(0, status, 3 + count);
+}
+
+// large message staged from uart chunks, handed to the network module once complete
+static uint8_t large_msg_buf[MESH_FRAG_MAX_MSG_LEN];
+static uint16_t large_msg_dst = 0;
+static uint16_t large_msg_len = 0;
+static uint16_t large_msg_received = 0;
+
+static void large_msg_done(void *done_ctx, uint16_t dst_address, bool acked) {
+    uint8_t event[4] = {UART_EVT_LARGE_DONE, dst_address >> 8, dst_address & 0xFF, acked};
+    uart_sendEvent(0, event, sizeof(event)); // btc or esp_timer task, never blocks on uart
+}
+
+// reply one status frame per chunk: opcode | status
+static void uart_op_send_large(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    uint16_t node_addr = read_be16(payload);
+    uint16_t total_length = read_be16(payload + 2);
+    uint16_t offset = read_be16(payload + 4);
+    uint8_t *chunk = payload + 6;
+    size_t chunk_len = length - 6;
+    uint8_t status[2] = {UART_OP_SEND_LARGE | UART_RSP_FLAG, UART_LARGE_STORED};
+
+    if (node_addr == 0) {
+        node_addr = PROV_OWN_ADDR; // root addr
+    }
+
+    if (offset == 0) {
+        large_msg_dst = node_addr;
+        large_msg_len = total_length;
+        large_msg_received = 0;
+    }
+
+    if (total_length == 0 || total_length > MESH_FRAG_MAX_MSG_LEN || node_addr != large_msg_dst || total_length != large_msg_len ||
+        offset != large_msg_received || offset + chunk_len > total_length) {
+        ESP_LOGE(TAG_E, "Large message chunk at offset %d of %d bytes out of order", offset, total_length);
+        large_msg_len = 0;
+        large_msg_received = 0;
+        status[1] = UART_LARGE_MALFORMED;
+        uart_sendData(0, status, sizeof(status));
+        return;
+    }
+
+    memcpy(large_msg_buf + offset, chunk, chunk_len);
+    large_msg_received += chunk_len;
+    if (large_msg_received == large_msg_len) {
+        esp_err_t err = send_large_message(large_msg_dst, large_msg_len, large_msg_buf, large_msg_done, NULL);
+        status[1] = (err == ESP_OK) ? UART_LARGE_STARTED : UART_LARGE_SEND_FAILED;
+        large_msg_len = 0;
+        large_msg_received = 0;
+    }
+    uart_sendData(0, status, sizeof(status));
+}
+
+// reply one status frame: opcode | status
+static void uart_op_group_sub(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    uint8_t status[2] = {UART_OP_GROUP_SUB | UART_RSP_FLAG, UART_GROUP_OK};
+    status[1] = subscribe_group(read_be16(payload)) == ESP_OK ? UART_GROUP_OK : UART_GROUP_FAILED;
+    uart_sendData(0, status, sizeof(status));
+}
+
+static void uart_op_group_unsub(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    uint8_t status[2] = {UART_OP_GROUP_UNSUB | UART_RSP_FLAG, UART_GROUP_OK};
+    status[1] = unsubscribe_group(read_be16(payload)) == ESP_OK ? UART_GROUP_OK : UART_GROUP_FAILED;
+    uart_sendData(0, status, sizeof(status));
+}
+
+static void uart_op_group_send(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    if (!(flags & UART_CMD_FLAG_ID)) {
+        send_group_message(read_be16(payload), length - NODE_ADDR_LEN, payload + NODE_ADDR_LEN);
+        return;
+    }
+
+    // group address goes as broadcast destination, nodes not subscribed drop it
+    uint16_t group_addr = read_be16(payload);
+    esp_err_t err = ESP_BLE_MESH_ADDR_IS_GROUP(group_addr) ? mesh_send_async(group_addr, length - NODE_ADDR_LEN, payload + NODE_ADDR_LEN,
+        MESH_DELIVERY_BROADCAST, uart_cmd_done, (void *) (uintptr_t) cmd_id, NULL) : ESP_ERR_INVALID_ARG;
+    if (err != ESP_OK) {
+        uart_cmd_send_done(cmd_id, UART_CMD_FAILED, err, NULL, 0);
+    }
+}
+
+// reply duplicate cache counters: opcode | 4 byte hits | 4 byte misses | 4 byte evictions
+static void uart_op_dedup_stats(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    mesh_dedup_stats_t stats;
+    uint8_t reply[1 + 3 * 4] = {UART_OP_DEDUP_STATS | UART_RSP_FLAG};
+
+    mesh_dedup_get_stats(&stats);
+    uint8_t *reply_itr = write_be32(reply + 1, stats.hits);
+    reply_itr = write_be32(reply_itr, stats.misses);
+    write_be32(reply_itr, stats.evictions);
+    uart_sendData(0, reply, sizeof(reply));
+}
+
+// reply send counters: opcode | 4 byte unsegmented | 4 byte segmented
+static void uart_op_send_stats(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    mesh_send_stats_t stats;
+    uint8_t reply[1 + 2 * 4] = {UART_OP_SEND_STATS | UART_RSP_FLAG};
+
+    mesh_send_get_stats(&stats);
+    write_be32(write_be32(reply + 1, stats.unsegmented), stats.segmented);
+    uart_sendData(0, reply, sizeof(reply));
+}
+
+// reply root heartbeat counters: opcode | 4 byte received | 1 byte hops | 1 byte min hops | 1 byte max hops
+// | 4 byte seconds since last one, 0xFFFFFFFF when none received
+static void uart_op_heartbeat_stats(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    mesh_heartbeat_stats_t stats;
+    uint8_t reply[1 + 4 + 3 + 4] = {UART_OP_HEARTBEAT_STATS | UART_RSP_FLAG};
+
+    mesh_heartbeat_get_stats(&stats);
+    uint32_t age_s = stats.last_rx_us == 0 ? UINT32_MAX : (uint32_t) ((esp_timer_get_time() - stats.last_rx_us) / 1000000);
+    uint8_t *reply_itr = write_be32(reply + 1, stats.received);
+    *reply_itr++ = stats.hops;
+    *reply_itr++ = stats.min_hops;
+    *reply_itr++ = stats.max_hops;
+    write_be32(reply_itr, age_s);
+    uart_sendData(0, reply, sizeof(reply));
+}
+
+// host credit for module to host traffic, no reply, module credits go out as UART_EVT_CREDIT
+static void uart_op_credit(uint8_t flags, uint16_t cmd_id, uint8_t *payload, size_t length) {
+    uart_tx_credit_update(read_be32(payload), read_be16(payload + 4), flags & UART_CMD_FLAG_RESTART);
+}
+
+// register new binary commands here
+static const uart_cmd_entry_t uart_cmd_table[UART_OP_MAX] = {
+    [UART_OP_SEND]          = {uart_op_send, NODE_ADDR_LEN + 1},
+    [UART_OP_BROADCAST]     = {uart_op_broadcast, 1},
+    [UART_OP_RESET_EDGE]    = {uart_op_reset_edge, 0},
+    [UART_OP_BAUD_PROPOSE]  = {uart_op_baud_propose, 4},
+    [UART_OP_BAUD_CONFIRM]  = {uart_op_baud_confirm, 0},
+    [UART_OP_SEND_BATCH]    = {uart_op_send_batch, 1},
+    [UART_OP_SEND_LARGE]    = {uart_op_send_large, 3 * 2 + 1},
+    [UART_OP_DEDUP_STATS]   = {uart_op_dedup_stats, 0},
+    [UART_OP_GROUP_SUB]     = {uart_op_group_sub, NODE_ADDR_LEN},
+    [UART_OP_GROUP_UNSUB]   = {uart_op_group_unsub, NODE_ADDR_LEN},
+    [UART_OP_GROUP_SEND]    = {uart_op_group_send, NODE_ADDR_LEN + 1},
+    [UART_OP_SEND_STATS]    = {uart_op_send_stats, 0},
+    [UART_OP_CREDIT]        = {uart_op_credit, 4 + 2},
+    [UART_OP_HEARTBEAT_STATS] = {uart_op_heartbeat_stats, 0},
+};
+
+static void execute_binary_command(uint8_t *command, size_t cmd_total_len) {
+    if (cmd_total_len < UART_CMD_HEADER_LEN) {
+        ESP_LOGE(TAG_E, "Binary command with %d byte too short", cmd_total_len);
+        return;
+    }
+
+    uint8_t opcode = command[0];
+    uint8_t flags = command[1];
+    size_t payload_length = read_be16(command + 2);
+    uint8_t *payload = command + UART_CMD_HEADER_LEN;
+    uint16_t cmd_id = 0;
+    const uart_cmd_entry_t *entry = &uart_cmd_table[opcode]; // opcode < UART_OP_MAX checked by caller
+
+    if (entry->handler == NULL) {
+        ESP_LOGE(TAG_E, "Binary opcode 0x%02x not Vaild", opcode);
+        uart_sendMsg(0, "Error: Unknown Command\n");
+        return;
+    } else if (payload_length != cmd_total_len - UART_CMD_HEADER_LEN || payload_length < entry->min_len) {
+        ESP_LOGE(TAG_E, "Binary opcode 0x%02x bad payload length %d", opcode, payload_length);
+        uart_sendMsg(0, "Error: Bad Command Length\n");
+        return;
+    }
+
+    if (flags & UART_CMD_FLAG_ID) {
+        if (payload_length < UART_CMD_ID_LEN + entry->min_len) {
+            ESP_LOGE(TAG_E, "Binary opcode 0x%02x bad payload length %d", opcode, payload_length);
+            uart_sendMsg(0, "Error: Bad Command Length\n");
+            return;
+        }
+        cmd_id = read_be16(payload);
+        payload += UART_CMD_ID_LEN;
+        payload_length -= UART_CMD_ID_LEN;
+    }
+
+    entry->handler(flags, cmd_id, payload, payload_length);
+    ESP_LOGI(TAG_E, "Binary command 0x%02x executed", opcode);
+}
+
+#if UART_ASCII_COMMANDS
+static void execute_ascii_command(char *command, size_t cmd_total_len) {
     // size_t cmd_len_raw = cmd_len;
 
     // ESP_LOGI(TAG_M, "execute_command called - %d byte raw - %d decoded byte", cmd_len_raw, cmd_len);
     // uart_sendMsg(0, "Executing command\n");
 
-    static const char *TAG_E = "EXE";
     static uint8_t *data_buffer = NULL;
     if (data_buffer == NULL) {
         data_buffer = (uint8_t*)malloc(128);
@@ -167,13 +640,7 @@ static void execute_uart_command(char *command, size_t cmd_total_len) {
 
         uint16_t node_addr_network_order = (uint16_t)((address_start[0] << 8) | address_start[1]);
         uint16_t node_addr = ntohs(node_addr_network_order);
-        if (node_addr == 0) {
-            node_addr = PROV_OWN_ADDR; // root addr
-        }
-        
-        ESP_LOGI(TAG_E, "Sending message to address-%d ...", node_addr);
-        send_message(node_addr, msg_length, (uint8_t *) msg_start, false);
-        ESP_LOGW(TAG_M, "<- Sended Message \'%.*s\' to node-%d", msg_length, (char*) msg_start, node_addr);
+        command_send(node_addr, (uint8_t *) msg_start, msg_length, 0, 0);
     }
     else if (strncmp(command, CMD_BROADCAST_MSG, CMD_LEN) == 0) {
         ESP_LOGI(TAG_E, "executing \'BCAST\'");
@@ -183,9 +650,23 @@ static void execute_uart_command(char *command, size_t cmd_total_len) {
         broadcast_message(msg_length, (uint8_t *)msg_start);
     } 
     else if (strncmp(command, CMD_RESET_EDGE, CMD_LEN) == 0) {
-        // restart edge module
-        setNodeState(DISCONNECTED);
-        reset_edge();
+        command_reset_edge();
+    }
+    else if (strncmp(command, CMD_BAUD_PROPOSE, CMD_LEN) == 0) {
+        // BAUD- | 4 byte baud rate (big endian) | optional 1 byte flags, bit 0 enables rts/cts
+        ESP_LOGI(TAG_E, "executing \'BAUD-\'");
+        if (cmd_total_len < CMD_LEN + 4) {
+            uart_sendMsg(0, "Error: No Baud Rate Attached\n");
+            return;
+        }
+
+        uint8_t *baud_start = (uint8_t *) command + CMD_LEN;
+        bool flow_ctrl = cmd_total_len > CMD_LEN + 4 && (baud_start[4] & 0x01);
+        uart_baud_propose(read_be32(baud_start), flow_ctrl);
+    }
+    else if (strncmp(command, CMD_BAUD_CONFIRM, CMD_LEN) == 0) {
+        ESP_LOGI(TAG_E, "executing \'BAUDC\'");
+        command_baud_confirm();
     }
     // else if (strncmp(command, "CLEAN", 5) == 0)
     // {
@@ -210,6 +691,21 @@ static void execute_uart_command(char *command, size_t cmd_total_len) {
 
     ESP_LOGI(TAG_E, "Command [%.*s] executed", cmd_total_len, command);
 }
+#endif
+
+static void execute_uart_command(char *command, size_t cmd_total_len) {
+    // ============= process and execute commands from net server (from uart) ==================
+    if (cmd_total_len > 0 && (uint8_t) command[0] < UART_OP_MAX) {
+        execute_binary_command((uint8_t *) command, cmd_total_len);
+        return;
+    }
+
+#if UART_ASCII_COMMANDS
+    execute_ascii_command(command, cmd_total_len);
+#else
+    ESP_LOGE(TAG_E, "Ascii commands disabled, command not Vaild");
+#endif
+}
 
 void execute_network_command(char *command, size_t cmd_total_len) {
 #if LOCAL_EDGE_DEVICE
@@ -218,61 +714,113 @@ void execute_network_command(char *command, size_t cmd_total_len) {
 #endif
 }
 
-static void uart_task_handler(char *data) {
-    ESP_LOGW(TAG_M, "uart_task_handler called ------------------");
+#if UART_LATENCY_TRACE
+static int64_t uart_rx_time_us = 0; // time the bytes of current read were handed to rx_task
+#endif
 
-    int cmd_start = 0;
-    int cmd_end = 0;
-    int cmd_len = 0;
+// uart_frame_handler() get triger by the uart parser for every complete and decoded frame
+static void uart_frame_handler(uint8_t *frame, size_t length) {
+    ESP_LOGI(TAG_M, "Decoded uart frame, cmd_len:%d", (int) length);
+    execute_uart_command((char *) frame, length);
 
-    for (int i = 0; i < UART_BUF_SIZE; i++) {
-        if (data[i] == 0xFF) {
-            // located start of message
-            cmd_start = i + 1; // start byte of actual message
-        } else if (data[i] == 0xFE) {
-            // located end of message
-            cmd_end = i; // 0xFE byte
-            // uart_sendMsg(0, "Found End of Message!!\n");
-        }
-
-        if (cmd_end > cmd_start) {
-            // located a message, message at least 1 byte
-            uint8_t* command = (uint8_t *) (data + cmd_start);
-            cmd_len = cmd_end - cmd_start;
-            cmd_len = uart_decoded_bytes(command, cmd_len, command); // decoded cmd will be put back to command pointer
-            ESP_LOGE("Decoded Data", "i:%d, cmd_start:%d, cmd_len:%d", i, cmd_start, cmd_len);
+#if UART_LATENCY_TRACE
+    ESP_LOGW(TAG_M, "uart rx to mesh send latency: %lld us, rx_task stack left %u bytes", esp_timer_get_time() - uart_rx_time_us,
+        (unsigned) uxTaskGetStackHighWaterMark(NULL));
+#endif
+}
 
-            execute_uart_command(data + cmd_start, cmd_len); // TB Finish, don't execute at the moment
-            cmd_start = cmd_end;
+#if UART_RX_MODE == UART_RX_MODE_EVENT
+// drain everything the driver buffered so far into the parser
+static void rx_read_buffered(uart_frame_parser_t *parser, uint8_t *data) {
+    size_t buffered = 0;
+    uart_get_buffered_data_len(UART_NUM, &buffered);
+
+    while (buffered > 0) {
+        size_t read_len = buffered < UART_BUF_SIZE ? buffered : UART_BUF_SIZE;
+        const int rxBytes = uart_read_bytes(UART_NUM, data, read_len, 0);
+        if (rxBytes <= 0) {
+            break;
         }
-    }
 
-    if (cmd_start > cmd_end) {
-        // one message is only been read half into buffer, edge case. Not consider at the moment
-        ESP_LOGE("E", "Buffer might have remaining half message!! cmd_start:%d, cmd_end:%d", cmd_start, cmd_end);
-        uart_sendMsg(0, "Error: Buffer might have remaining half message!!\n");
+        uart_parser_feed(parser, data, rxBytes, uart_frame_handler);
+        uart_rx_credit_return(rxBytes);
+        buffered -= rxBytes;
     }
 }
+#endif
 
-// TB Finish, do we need to make sure there isn't haf of message left in buffer
-// when read entire bufffer, no message got read as half, or metho to recover it? 
 static void rx_task(void *arg)
 {
     // esp_log_level_set(TAG_ALL, ESP_LOG_NONE);
 
     static const char *RX_TASK_TAG = "RX";
-    uint8_t* data = (uint8_t*) malloc(UART_BUF_SIZE + 1);
+    static uart_frame_parser_t uart_parser;
+    uint8_t* data = (uint8_t*) malloc(UART_BUF_SIZE);
+    if (data == NULL) {
+        ESP_LOGE(RX_TASK_TAG, "Failed to allocate uart rx buffer");
+        vTaskDelete(NULL);
+        return;
+    }
+
+    uart_parser_init(&uart_parser);
+    uart_rx_credit_reset(); // tells host the rx window
     ESP_LOGW(RX_TASK_TAG, "rx_task called ------------------");
+
+#if UART_RX_MODE == UART_RX_MODE_EVENT
+    QueueHandle_t uart_queue = uart_get_event_queue();
+    uart_event_t event;
+
     while (1) {
-        memset(data, 0, UART_BUF_SIZE);
+        if (xQueueReceive(uart_queue, &event, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+#if UART_LATENCY_TRACE
+        uart_rx_time_us = esp_timer_get_time();
+#endif
+
+        switch (event.type) {
+        case UART_PATTERN_DET:
+            // frame end byte arrived, frame is already in the driver buffer
+            uart_pattern_pop_pos(UART_NUM);
+            rx_read_buffered(&uart_parser, data);
+            break;
+        case UART_DATA:
+            // no end byte yet, keep the partial frame in the parser
+            rx_read_buffered(&uart_parser, data);
+            break;
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            ESP_LOGE(RX_TASK_TAG, "uart rx overflow (event %d), flushing input", event.type);
+            uart_flush_input(UART_NUM);
+            xQueueReset(uart_queue);
+            uart_pattern_queue_reset(UART_NUM, UART_PATTERN_QUEUE_LEN);
+            uart_parser_init(&uart_parser);
+            uart_sendMsg(0, "Error: uart rx overflow, input flushed\n");
+            uart_rx_credit_reset();
+            break;
+        default:
+            ESP_LOGW(RX_TASK_TAG, "uart event type: %d", event.type);
+            break;
+        }
+    }
+#else
+    while (1) {
+#if UART_LATENCY_TRACE
+        int64_t read_start_us = esp_timer_get_time();
+#endif
         const int rxBytes = uart_read_bytes(UART_NUM, data, UART_BUF_SIZE, 1000 / portTICK_PERIOD_MS);
         if (rxBytes > 0) {
-            ESP_LOGI(RX_TASK_TAG, "Read %d bytes: '%s'", rxBytes, data);
-            // uart_sendMsg(rxBytes, " readed from RX\n");
-
-            uart_task_handler((char*) data);
+            ESP_LOGI(RX_TASK_TAG, "Read %d bytes", rxBytes);
+#if UART_LATENCY_TRACE
+            uart_rx_time_us = esp_timer_get_time();
+            ESP_LOGW(RX_TASK_TAG, "uart read waited %lld us", uart_rx_time_us - read_start_us);
+#endif
+            // only scan bytes actually received, partial frame stays in the parser until the next read
+            uart_parser_feed(&uart_parser, data, rxBytes, uart_frame_handler);
+            uart_rx_credit_return(rxBytes);
         }
     }
+#endif
     free(data);
 }
 
@@ -285,7 +833,7 @@ void app_main(void)
     // esp_log_level_set(TAG_ALL, ESP_LOG_NONE);
     // uart_sendMsg(0, "[UART] Turning off all Log's from esp_log\n");
 
-    esp_err_t err = esp_module_edge_init(prov_complete_handler, config_complete_handler, recv_message_handler, recv_response_handler, timeout_handler, broadcast_handler, connectivity_handler);
+    esp_err_t err = esp_module_edge_init(prov_complete_handler, config_complete_handler, recv_message_handler, recv_response_handler, timeout_handler, broadcast_handler, connectivity_handler, important_failed_handler, backpressure_handler);
     if (err != ESP_OK) {
         ESP_LOGE(TAG_M, "Network Module Initialization failed (err %d)", err);
         uart_sendMsg(0, "Error: Network Module Initialization failed\n");
@@ -293,7 +841,8 @@ void app_main(void)
     }
     
     board_init();
-    xTaskCreate(rx_task, "uart_rx_task", 1024 * 2, NULL, configMAX_PRIORITIES - 1, NULL);
+    // commands run to the mesh send and the uart reply on this stack, logging included
+    xTaskCreate(rx_task, "uart_rx_task", 1024 * 4, NULL, configMAX_PRIORITIES - 1, NULL);
 
     char message[15] = "[E]online\n";
     uart_sendData(0, (uint8_t *)message, strlen(message));
@@ -0,0 +1,243 @@
+/* telemetry.c - Telemetry coalescing, packs many small samples into one mesh message */
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "ble_mesh_config_edge.h"
+#include "telemetry.h"
+
+#define TAG_T "[Telemetry]"
+
+typedef struct {
+    uint16_t dst_address;   // 0 for unused buffer
+    uint8_t sample_count;
+    uint16_t length;        // batch header + samples
+    esp_timer_handle_t flush_timer;
+    uint8_t data[TELEMETRY_FLUSH_BYTES];
+} telemetry_buffer_t;
+
+static telemetry_buffer_t telemetry_buffers[TELEMETRY_MAX_DESTS];
+static SemaphoreHandle_t telemetry_lock = NULL;
+
+// caller holds telemetry_lock
+static void telemetry_flush_buffer(telemetry_buffer_t *buffer) {
+    esp_timer_stop(buffer->flush_timer); // not running is fine
+    if (buffer->sample_count == 0) {
+        return;
+    }
+
+    uint8_t *msg = buffer->data;
+    uint16_t msg_len = buffer->length;
+    buffer->data[0] = TELEMETRY_BATCH_OPCODE;
+    buffer->data[1] = buffer->sample_count;
+#if MESH_COMPACT_HEADERS
+    if (buffer->sample_count == 1) {
+        // single sample goes bare, 3 bytes less can keep it unsegmented
+        msg = buffer->data + TELEMETRY_BATCH_HDR_LEN + 1;
+        msg_len = buffer->length - TELEMETRY_BATCH_HDR_LEN - 1;
+    }
+#endif
+    esp_err_t err = mesh_send(buffer->dst_address, msg_len, msg, MESH_DELIVERY_NORMAL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_T, "Failed to send %d samples to node addr 0x%04x, err_code %d", buffer->sample_count, buffer->dst_address, err);
+    }
+
+    buffer->sample_count = 0;
+    buffer->length = TELEMETRY_BATCH_HDR_LEN;
+}
+
+// caller holds telemetry_lock
+static telemetry_buffer_t* telemetry_get_buffer(uint16_t dst_address) {
+    telemetry_buffer_t *empty_buffer = NULL;
+
+    for (int i = 0; i < TELEMETRY_MAX_DESTS; i++) {
+        if (telemetry_buffers[i].dst_address == dst_address) {
+            return &telemetry_buffers[i];
+        } else if (empty_buffer == NULL && telemetry_buffers[i].sample_count == 0) {
+            empty_buffer = &telemetry_buffers[i];
+        }
+    }
+
+    if (empty_buffer != NULL) {
+        empty_buffer->dst_address = dst_address;
+    }
+    return empty_buffer;
+}
+
+// max latency reached, runs in esp_timer task
+static void telemetry_flush_timer_callback(void *arg) {
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+    telemetry_flush_buffer((telemetry_buffer_t *) arg);
+    xSemaphoreGive(telemetry_lock);
+}
+
+esp_err_t telemetry_add_sample(uint16_t dst_address, const uint8_t *sample, uint8_t length) {
+    if (telemetry_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    } else if (length == 0 || TELEMETRY_BATCH_HDR_LEN + 1 + length > TELEMETRY_FLUSH_BYTES) {
+        ESP_LOGE(TAG_T, "Sample %d bytes doesn't fit TELEMETRY_FLUSH_BYTES-%d", length, TELEMETRY_FLUSH_BYTES);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+    telemetry_buffer_t *buffer = telemetry_get_buffer(dst_address);
+    if (buffer == NULL) {
+        xSemaphoreGive(telemetry_lock);
+        ESP_LOGW(TAG_T, "No telemetry buffer free for node addr 0x%04x", dst_address);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (buffer->length + 1 + length > TELEMETRY_FLUSH_BYTES || buffer->sample_count == UINT8_MAX) {
+        telemetry_flush_buffer(buffer);
+    }
+    if (buffer->sample_count == 0) {
+        esp_timer_start_once(buffer->flush_timer, TELEMETRY_MAX_LATENCY_US);
+    }
+
+    buffer->data[buffer->length] = length;
+    memcpy(buffer->data + buffer->length + 1, sample, length);
+    buffer->length += 1 + length;
+    buffer->sample_count += 1;
+
+    if (buffer->length >= TELEMETRY_FLUSH_BYTES) {
+        telemetry_flush_buffer(buffer);
+    }
+    xSemaphoreGive(telemetry_lock);
+
+    return ESP_OK;
+}
+
+void telemetry_flush(uint16_t dst_address) {
+    if (telemetry_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+    for (int i = 0; i < TELEMETRY_MAX_DESTS; i++) {
+        if (telemetry_buffers[i].dst_address == dst_address) {
+            telemetry_flush_buffer(&telemetry_buffers[i]);
+        }
+    }
+    xSemaphoreGive(telemetry_lock);
+}
+
+esp_err_t telemetry_init() {
+    if (telemetry_lock != NULL) {
+        return ESP_OK;
+    }
+
+    telemetry_lock = xSemaphoreCreateMutex();
+    if (telemetry_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < TELEMETRY_MAX_DESTS; i++) {
+        telemetry_buffers[i].dst_address = 0;
+        telemetry_buffers[i].sample_count = 0;
+        telemetry_buffers[i].length = TELEMETRY_BATCH_HDR_LEN;
+
+        const esp_timer_create_args_t flush_timer_args = {
+                .callback = &telemetry_flush_timer_callback,
+                .arg = &telemetry_buffers[i],
+                .name = "telemetry_flush"
+        };
+        esp_err_t err = esp_timer_create(&flush_timer_args, &telemetry_buffers[i].flush_timer);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    return ESP_OK;
+}
+
+// ====== delta/varint encoded streams ======
+static uint8_t* telemetry_put_varint(uint8_t *itr, int32_t value) {
+    uint32_t zigzag = ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+
+    while (zigzag >= 0x80) {
+        *itr++ = (zigzag & 0x7F) | 0x80;
+        zigzag >>= 7;
+    }
+    *itr++ = zigzag;
+    return itr;
+}
+
+// keyframe acked or given up on, runs in btc or esp_timer task
+static void telemetry_keyframe_done(void *done_ctx, uint16_t dst_address, bool acked) {
+    telemetry_stream_t *stream = (telemetry_stream_t *) done_ctx;
+
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+    stream->key_pending = false;
+    if (acked) {
+        memcpy(stream->key_values, stream->pending_values, sizeof(stream->key_values));
+        stream->key_id = stream->next_key_id - 1;
+        stream->key_acked = true;
+        stream->since_key = 0;
+    }
+    xSemaphoreGive(telemetry_lock);
+}
+
+void telemetry_stream_init(telemetry_stream_t *stream, uint16_t dst_address, uint8_t field_count) {
+    memset(stream, 0, sizeof(*stream));
+    stream->dst_address = dst_address;
+    stream->field_count = field_count < TELEMETRY_MAX_FIELDS ? field_count : TELEMETRY_MAX_FIELDS;
+    stream->since_key = TELEMETRY_KEYFRAME_INTERVAL;
+}
+
+esp_err_t telemetry_add_fields(telemetry_stream_t *stream, const int32_t *fields) {
+    uint8_t frame[3 + TELEMETRY_MAX_FIELDS * TELEMETRY_VARINT_MAX_LEN];
+    uint8_t *itr = frame;
+    bool keyframe = false;
+
+    if (telemetry_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+    if (!stream->key_pending && stream->since_key >= TELEMETRY_KEYFRAME_INTERVAL) {
+        keyframe = true;
+        stream->key_pending = true;
+        memcpy(stream->pending_values, fields, stream->field_count * sizeof(int32_t));
+        *itr++ = TELEMETRY_KEYFRAME_OPCODE;
+        *itr++ = stream->next_key_id++;
+        *itr++ = stream->field_count;
+        for (int i = 0; i < stream->field_count; i++) {
+            itr = telemetry_put_varint(itr, fields[i]);
+        }
+    } else if (stream->key_acked) {
+        *itr++ = TELEMETRY_DELTA_OPCODE;
+        *itr++ = stream->key_id;
+        for (int i = 0; i < stream->field_count; i++) {
+            itr = telemetry_put_varint(itr, (int32_t) ((uint32_t) fields[i] - (uint32_t) stream->key_values[i]));
+        }
+    } else {
+        *itr++ = TELEMETRY_VALUES_OPCODE;
+        *itr++ = stream->field_count;
+        for (int i = 0; i < stream->field_count; i++) {
+            itr = telemetry_put_varint(itr, fields[i]);
+        }
+    }
+
+    if (stream->since_key < UINT16_MAX) {
+        stream->since_key += 1;
+    }
+    xSemaphoreGive(telemetry_lock);
+
+    if (!keyframe) {
+        return telemetry_add_sample(stream->dst_address, frame, itr - frame);
+    }
+
+    esp_err_t err = send_important_message_notify(stream->dst_address, itr - frame, frame, telemetry_keyframe_done, stream);
+    if (err == ESP_OK) {
+        return ESP_OK;
+    }
+
+    // keyframe not sent, try again next sample and don't lose this one, same fields as values frame
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+    stream->key_pending = false;
+    xSemaphoreGive(telemetry_lock);
+    frame[1] = TELEMETRY_VALUES_OPCODE;
+    return telemetry_add_sample(stream->dst_address, frame + 1, itr - frame - 1);
+}
@@ -0,0 +1,94 @@
+/* telemetry.h - Telemetry coalescing, packs many small samples into one mesh message */
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// batch message - 'B' | 1 byte sample count | count * (1 byte sample length | sample)
+// with MESH_COMPACT_HEADERS a batch of one sample is sent as the bare sample
+#define TELEMETRY_BATCH_OPCODE      'B'
+#define TELEMETRY_BATCH_HDR_LEN     2
+
+#define TELEMETRY_MAX_DESTS         2           // destinations buffered at once
+#define TELEMETRY_FLUSH_BYTES       64          // flush once the batch message reaches this size
+#define TELEMETRY_MAX_LATENCY_US    5000000     // flush 5s after the first buffered sample at the latest
+
+// sample encoding, TELEMETRY_ENCODING_DELTA sends fields as zig-zag varints against the last acked keyframe, opt in
+// only once root and host decode 'K'/'V'/'d' samples
+#define TELEMETRY_ENCODING_RAW      0
+#define TELEMETRY_ENCODING_DELTA    1
+#define TELEMETRY_ENCODING          TELEMETRY_ENCODING_RAW
+
+// encoded samples, decoded by tools/telemetry_decode.py
+// keyframe - 'K' | 1 byte keyframe id | 1 byte field count | count * varint, sent alone as important message
+// values   - 'V' | 1 byte field count | count * varint, while no keyframe is acked
+// delta    - 'd' | 1 byte keyframe id | count * varint of (field - keyframe field)
+#define TELEMETRY_KEYFRAME_OPCODE   'K'
+#define TELEMETRY_VALUES_OPCODE     'V'
+#define TELEMETRY_DELTA_OPCODE      'd'
+#define TELEMETRY_MAX_FIELDS        8
+#define TELEMETRY_KEYFRAME_INTERVAL 30          // samples between keyframes, resyncs receiver and keeps deltas small
+#define TELEMETRY_VARINT_MAX_LEN    5           // int32 as zig-zag varint
+
+typedef struct {
+    uint16_t dst_address;
+    uint8_t field_count;
+    uint8_t key_id;                             // id of key_values, valid when key_acked
+    uint8_t next_key_id;
+    bool key_acked;
+    bool key_pending;                           // keyframe with pending_values sent, waiting for ack
+    uint16_t since_key;                         // samples since last keyframe
+    int32_t key_values[TELEMETRY_MAX_FIELDS];
+    int32_t pending_values[TELEMETRY_MAX_FIELDS];
+} telemetry_stream_t;
+
+/**
+ * @brief Initialize the telemetry buffers and their flush timers.
+ */
+esp_err_t telemetry_init();
+
+/**
+ * @brief Buffer one telemetry sample for a destination.
+ * 
+ *  Samples are sent as one batch message when TELEMETRY_FLUSH_BYTES is reached or TELEMETRY_MAX_LATENCY_US
+ *  after the first sample in the batch, whichever comes first.
+ * 
+ * @param dst_address Destination node's unicast address.
+ * @param sample Pointer to the sample, copied before return.
+ * @param length Length of the sample, must fit in one batch message.
+ * @return ESP_OK if buffered, ESP_ERR_NO_MEM if all TELEMETRY_MAX_DESTS buffers hold other destinations' samples.
+ */
+esp_err_t telemetry_add_sample(uint16_t dst_address, const uint8_t *sample, uint8_t length);
+
+/**
+ * @brief Send the samples buffered for a destination now.
+ * 
+ * @param dst_address Destination node's unicast address.
+ */
+void telemetry_flush(uint16_t dst_address);
+
+/**
+ * @brief Initialize an encoded telemetry stream, first sample goes out as keyframe.
+ * 
+ * @param stream Stream state, must stay valid while samples are sent on it.
+ * @param dst_address Destination node's unicast address.
+ * @param field_count Number of fields per sample, up to TELEMETRY_MAX_FIELDS.
+ */
+void telemetry_stream_init(telemetry_stream_t *stream, uint16_t dst_address, uint8_t field_count);
+
+/**
+ * @brief Encode one sample and send it on the stream.
+ * 
+ *  Every TELEMETRY_KEYFRAME_INTERVAL samples a keyframe is sent as important message. Once a keyframe is acked the
+ *  following samples are sent as deltas against it, buffered with telemetry_add_sample().
+ * 
+ * @param stream Stream initialized by telemetry_stream_init().
+ * @param fields field_count values of the sample.
+ * @return ESP_OK if sent or buffered.
+ */
+esp_err_t telemetry_add_fields(telemetry_stream_t *stream, const int32_t *fields);
+
+#endif /* _TELEMETRY_H_ */
@@ -0,0 +1,131 @@
+/* uart_frame.c - Uart frame encoding and parsing */
+
+#include "uart_frame.h"
+
+// escape char
+size_t uart_encode_bytes(const uint8_t* data, size_t length, uint8_t* encoded_data) {
+    uint8_t* encode_itr = encoded_data;
+
+    for (const uint8_t* byte_itr = data; byte_itr < data + length; ++byte_itr) {
+        if (byte_itr[0] < ESCAPE_BYTE) {
+            encode_itr[0] = byte_itr[0];
+            encode_itr += 1;
+            continue;
+        }
+
+        // need 2 byte encoded
+        encode_itr[0] = ESCAPE_BYTE;
+        encode_itr[1] = byte_itr[0] ^ ESCAPE_BYTE; // bitwise Xor
+        encode_itr += 2;
+    }
+
+    return encode_itr - encoded_data;
+}
+
+size_t uart_build_frame(uint16_t node_addr, const uint8_t* data, size_t length, uint8_t* frame_buf, size_t buf_size) {
+    if (buf_size < UART_FRAME_ENCODED_LEN(length)) {
+        return 0;
+    }
+
+    uint8_t* frame_itr = frame_buf;
+    uint8_t node_addr_big_endian[NODE_ADDR_LEN] = {node_addr >> 8, node_addr & 0xFF};
+
+    frame_itr[0] = UART_START; // 0xFF
+    frame_itr += 1;
+    frame_itr += uart_encode_bytes(node_addr_big_endian, NODE_ADDR_LEN, frame_itr);
+    if (data != NULL) {
+        frame_itr += uart_encode_bytes(data, length, frame_itr);
+    }
+    frame_itr[0] = UART_END; // 0xFE
+    frame_itr += 1;
+
+    return frame_itr - frame_buf;
+}
+
+// Able to wrote back to the same buffer, since decoded data is always shorter
+int uart_decoded_bytes(uint8_t* data, size_t length, uint8_t* decoded_data) {
+    int decoed_len = 0;
+    uint8_t* decode_itr = decoded_data;
+
+    for (uint8_t* byte_itr = data; byte_itr < data + length; ++byte_itr) {
+        if (byte_itr[0] != ESCAPE_BYTE) {
+            // not a ESCAPE_BYTE
+            decode_itr[0] = byte_itr[0];
+            decode_itr += 1;
+            decoed_len += 1;
+            continue;
+        }
+
+        // ESCAPE_BYTE, decode 2 byte into 1
+        byte_itr += 1; // move to next to get encoded byte
+        uint8_t encoded = byte_itr[0];
+        
+        uint8_t decoded = encoded ^ ESCAPE_BYTE; // bitwise Xor
+        decode_itr[0] = decoded;
+        decode_itr += 1;
+        decoed_len += 1;
+    }
+    
+    return decoed_len;
+}
+
+void uart_parser_init(uart_frame_parser_t* parser) {
+    parser->state = UART_PARSER_IDLE;
+    parser->frame_len = 0;
+    parser->frames_dropped = 0;
+}
+
+size_t uart_parser_feed(uart_frame_parser_t* parser, const uint8_t* data, size_t length, uart_frame_handler_t frame_handler) {
+    size_t frames = 0;
+
+    for (const uint8_t* byte_itr = data; byte_itr < data + length; ++byte_itr) {
+        uint8_t byte = byte_itr[0];
+
+        if (byte == UART_START) {
+            // start byte always begins a new frame, anything collected so far was a broken frame
+            if (parser->state != UART_PARSER_IDLE && parser->frame_len > 0) {
+                parser->frames_dropped += 1;
+            }
+            parser->state = UART_PARSER_IN_FRAME;
+            parser->frame_len = 0;
+            continue;
+        }
+
+        if (parser->state == UART_PARSER_IDLE) {
+            continue; // noise between frames
+        }
+
+        if (byte == UART_END) {
+            if (parser->state == UART_PARSER_ESCAPE) {
+                parser->frames_dropped += 1; // frame ended in the middle of an escape sequence
+            } else if (parser->frame_len > 0) {
+                frame_handler(parser->frame, parser->frame_len);
+                frames += 1;
+            }
+            parser->state = UART_PARSER_IDLE;
+            continue;
+        }
+
+        if (parser->state == UART_PARSER_IN_FRAME && byte == ESCAPE_BYTE) {
+            parser->state = UART_PARSER_ESCAPE;
+            continue;
+        }
+
+        if (parser->state == UART_PARSER_ESCAPE) {
+            byte ^= ESCAPE_BYTE; // bitwise Xor
+            parser->state = UART_PARSER_IN_FRAME;
+        }
+
+        if (parser->frame_len >= sizeof(parser->frame)) {
+            // oversized frame, drop it and wait for the next start byte
+            parser->frames_dropped += 1;
+            parser->state = UART_PARSER_IDLE;
+            continue;
+        }
+
+        parser->frame[parser->frame_len] = byte;
+        parser->frame_len += 1;
+    }
+
+    return frames;
+}
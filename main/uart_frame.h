@@ -0,0 +1,96 @@
+/* uart_frame.h - Uart frame encoding and parsing, plain C so it also builds on the host for tools/uart_bench.c */
+
+#ifndef _UART_FRAME_H_
+#define _UART_FRAME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../Secret/NetworkConfig.h"
+
+#define ESCAPE_BYTE 0xFA
+#define UART_START 0xFF
+#define UART_END 0xFE
+#define UART_MAX_PAYLOAD_LEN 384 // largest payload forwarded in one uart frame, matches mesh SDU limit
+
+// worst case frame size: start byte + every address/payload byte escaped into 2 bytes + end byte
+#define UART_FRAME_ENCODED_LEN(payload_len) (2 + 2 * (NODE_ADDR_LEN + (payload_len)))
+// largest decoded command frame accepted from uart: command + address + payload
+#define UART_RX_FRAME_MAX_LEN (CMD_LEN + NODE_ADDR_LEN + UART_MAX_PAYLOAD_LEN)
+
+enum uart_parser_state {
+    UART_PARSER_IDLE,       // waiting for UART_START
+    UART_PARSER_IN_FRAME,   // collecting frame bytes
+    UART_PARSER_ESCAPE,     // last byte was ESCAPE_BYTE, next byte is encoded
+};
+
+/**
+ * @brief Callback invoked with every complete, decoded frame. The frame buffer is reused once the callback returns.
+ */
+typedef void (*uart_frame_handler_t)(uint8_t* frame, size_t length);
+
+/**
+ * @brief Incremental uart frame parser, keeps a partially received frame across reads.
+ */
+typedef struct {
+    enum uart_parser_state state;
+    size_t frame_len;
+    uint32_t frames_dropped; // oversized or malformed frames
+    uint8_t frame[UART_RX_FRAME_MAX_LEN];
+} uart_frame_parser_t;
+
+/**
+ * @brief Escape bytes into the provided buffer.
+ * 
+ * Every byte >= ESCAPE_BYTE is written as ESCAPE_BYTE followed by the byte xor ESCAPE_BYTE.
+ * 
+ * @param data Pointer to the raw data.
+ * @param length Length of the raw data.
+ * @param encoded_data Pointer to the output buffer, must hold at least 2 * length bytes.
+ * @return Number of bytes written to encoded_data.
+ */
+size_t uart_encode_bytes(const uint8_t* data, size_t length, uint8_t* encoded_data);
+
+/**
+ * @brief Build a complete uart frame (start byte, encoded address, encoded payload, end byte) in one buffer.
+ * 
+ * @param node_addr Node address carried in the frame.
+ * @param data Pointer to the payload.
+ * @param length Length of the payload.
+ * @param frame_buf Pointer to the output buffer.
+ * @param buf_size Size of frame_buf, UART_FRAME_ENCODED_LEN(length) always fits.
+ * @return Length of the frame, 0 if frame_buf is too small.
+ */
+size_t uart_build_frame(uint16_t node_addr, const uint8_t* data, size_t length, uint8_t* frame_buf, size_t buf_size);
+
+/**
+ * @brief Decode bytes from the provided data.
+ * 
+ * @param data Pointer to the encoded data.
+ * @param length Length of the encoded data.
+ * @param decoded_data Pointer to the buffer for the decoded data.
+ * @return Status of the decode operation.
+ */
+int uart_decoded_bytes(uint8_t* data, size_t length, uint8_t* decoded_data);
+
+/**
+ * @brief Reset a uart frame parser to idle state.
+ * 
+ * @param parser Pointer to the parser.
+ */
+void uart_parser_init(uart_frame_parser_t* parser);
+
+/**
+ * @brief Feed received bytes into a uart frame parser.
+ * 
+ *  Bytes are unescaped in the same pass, a frame split across several reads is kept in the parser
+ *  and completed by a later call. Every complete frame is passed to frame_handler.
+ * 
+ * @param parser Pointer to the parser.
+ * @param data Pointer to the received bytes.
+ * @param length Number of received bytes.
+ * @param frame_handler Callback for complete frames.
+ * @return Number of frames dispatched.
+ */
+size_t uart_parser_feed(uart_frame_parser_t* parser, const uint8_t* data, size_t length, uart_frame_handler_t frame_handler);
+
+#endif /* _UART_FRAME_H_ */
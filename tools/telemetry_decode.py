@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""Host side decoder for edge telemetry messages, see main/telemetry.h for the formats.
+
+Reads one uart message per line as hex, `2_byte_node_addr | payload` (uart escaping already removed),
+and prints the decoded samples.
+
+    python3 tools/telemetry_decode.py < messages.txt
+"""
+
+import sys
+
+BATCH_OPCODE = ord('B')
+KEYFRAME_OPCODE = ord('K')
+VALUES_OPCODE = ord('V')
+DELTA_OPCODE = ord('d')
+
+
+def read_varint(data, pos):
+    """Read one zig-zag varint at pos, returns (value, next_pos)."""
+    zigzag = 0
+    shift = 0
+    while True:
+        if pos >= len(data):
+            raise ValueError("truncated varint")
+        byte = data[pos]
+        pos += 1
+        zigzag |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            break
+    return (zigzag >> 1) ^ -(zigzag & 1), pos
+
+
+def to_int32(value):
+    value &= 0xFFFFFFFF
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+class TelemetryDecoder:
+    """Keeps the keyframes of every node, deltas in a late batch may still refer to an older keyframe."""
+
+    def __init__(self):
+        self.keyframes = {}  # (node_addr, key_id) -> fields
+
+    def decode(self, node_addr, payload):
+        """Decode one mesh message, returns a list of samples, raw samples are returned as bytes."""
+        if not payload:
+            return []
+        if payload[0] == BATCH_OPCODE:
+            samples = []
+            pos = 2
+            for _ in range(payload[1]):
+                length = payload[pos]
+                samples.extend(self.decode_sample(node_addr, payload[pos + 1:pos + 1 + length]))
+                pos += 1 + length
+            return samples
+        return self.decode_sample(node_addr, payload)
+
+    def decode_sample(self, node_addr, sample):
+        opcode = sample[0]
+        if opcode == KEYFRAME_OPCODE:
+            key_id, count = sample[1], sample[2]
+            fields = self.read_fields(sample, 3, count)
+            self.keyframes[(node_addr, key_id)] = fields
+            return [fields]
+        if opcode == VALUES_OPCODE:
+            return [self.read_fields(sample, 2, sample[1])]
+        if opcode == DELTA_OPCODE:
+            key = self.keyframes.get((node_addr, sample[1]))
+            if key is None:
+                raise ValueError("delta against unknown keyframe %d from node %d" % (sample[1], node_addr))
+            deltas = self.read_fields(sample, 2, len(key))
+            return [[to_int32(k + d) for k, d in zip(key, deltas)]]
+        return [bytes(sample)]
+
+    @staticmethod
+    def read_fields(data, pos, count):
+        fields = []
+        for _ in range(count):
+            value, pos = read_varint(data, pos)
+            fields.append(value)
+        return fields
+
+
+def main():
+    decoder = TelemetryDecoder()
+    for line in sys.stdin:
+        line = line.strip()
+        if not line:
+            continue
+        message = bytes.fromhex(line)
+        node_addr = (message[0] << 8) | message[1]
+        try:
+            for sample in decoder.decode(node_addr, message[2:]):
+                print("%d: %s" % (node_addr, sample))
+        except (ValueError, IndexError) as err:
+            print("%d: undecodable %s (%s)" % (node_addr, message[2:].hex(), err))
+
+
+if __name__ == "__main__":
+    main()
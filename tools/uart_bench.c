@@ -0,0 +1,469 @@
+/* uart_bench.c - Host benchmark of the uart framing code in main/uart_frame.c
+ *
+ * Build and run from the repo root:
+ *   gcc -O2 -Wall -Imain tools/uart_bench.c main/uart_frame.c -o uart_bench -lpthread && ./uart_bench [write|parse|send|rx]
+ *
+ * uart_write_bytes() is replaced by a driver stand-in that takes a mutex and copies into a ring, which is what
+ * the esp-idf driver does per call before the isr drains it. Numbers are host cpu time and only compare paths.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include "uart_frame.h"
+
+#define BENCH_DRIVER_RING_SIZE  2048
+#define BENCH_UART_BUF_SIZE     1024    // rx_task read buffer, UART_BUF_SIZE in board.h
+#define BENCH_RX_STREAM_LEN     (256 * 1024)
+#define BENCH_MAX_MSG_LEN       256     // MAX_MSG_LEN in local_edge_device.c
+#define BENCH_RX_FRAMES         150
+#define BENCH_RX_READ_TIMEOUT_NS 1000000000LL // rx_task polling read timeout
+
+static pthread_mutex_t bench_driver_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t bench_driver_ring[BENCH_DRIVER_RING_SIZE];
+static size_t bench_driver_head = 0;
+
+static int64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench_fill_random(uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        data[i] = rand() & 0xFF;
+    }
+}
+
+// stands in for uart_write_bytes(), one lock and copy into the tx ring per call
+static int bench_driver_write(const uint8_t *data, size_t length) {
+    pthread_mutex_lock(&bench_driver_lock);
+    for (size_t i = 0; i < length; i++) {
+        bench_driver_ring[bench_driver_head] = data[i];
+        bench_driver_head = (bench_driver_head + 1) % BENCH_DRIVER_RING_SIZE;
+    }
+    pthread_mutex_unlock(&bench_driver_lock);
+    return length;
+}
+
+// ============================ write path ============================
+// per byte driver writes, as uart_sendData() did before frames were built in one buffer
+static int bench_write_per_byte_encoded(const uint8_t *data, size_t length) {
+    uint8_t escape_byte = ESCAPE_BYTE;
+    int byte_wrote = 0;
+
+    for (const uint8_t *byte_itr = data; byte_itr < data + length; ++byte_itr) {
+        if (byte_itr[0] < escape_byte) {
+            byte_wrote += bench_driver_write(byte_itr, 1);
+            continue;
+        }
+        uint8_t encoded = byte_itr[0] ^ escape_byte;
+        byte_wrote += bench_driver_write(&escape_byte, 1);
+        byte_wrote += bench_driver_write(&encoded, 1);
+    }
+    return byte_wrote;
+}
+
+static int bench_write_per_byte(uint16_t node_addr, const uint8_t *data, size_t length) {
+    uint8_t uart_start = UART_START;
+    uint8_t uart_end = UART_END;
+    uint8_t node_addr_big_endian[NODE_ADDR_LEN] = {node_addr >> 8, node_addr & 0xFF};
+    int txBytes = 0;
+
+    txBytes += bench_driver_write(&uart_start, 1);
+    txBytes += bench_write_per_byte_encoded(node_addr_big_endian, NODE_ADDR_LEN);
+    txBytes += bench_write_per_byte_encoded(data, length);
+    txBytes += bench_driver_write(&uart_end, 1);
+    return txBytes;
+}
+
+// one frame buffer and one driver write, as uart_tx_task does now
+static int bench_write_frame(uint16_t node_addr, const uint8_t *data, size_t length) {
+    static uint8_t frame_buf[UART_FRAME_ENCODED_LEN(1024)];
+    size_t frame_len = uart_build_frame(node_addr, data, length, frame_buf, sizeof(frame_buf));
+    return bench_driver_write(frame_buf, frame_len);
+}
+
+static void bench_write(void) {
+    static const size_t payload_lens[] = {16, 64, 200, 384};
+    static uint8_t payload[384];
+
+    printf("write path, random payload, ns per frame and payload MB/s\n");
+    printf("%8s %14s %10s %14s %10s %8s\n", "payload", "per-byte ns", "MB/s", "one-write ns", "MB/s", "speedup");
+    for (size_t i = 0; i < sizeof(payload_lens) / sizeof(payload_lens[0]); i++) {
+        size_t length = payload_lens[i];
+        int iterations = 2000000 / length;
+        bench_fill_random(payload, length);
+
+        int64_t start = bench_now_ns();
+        for (int n = 0; n < iterations; n++) {
+            bench_write_per_byte(0x0005, payload, length);
+        }
+        double per_byte_ns = (double) (bench_now_ns() - start) / iterations;
+
+        start = bench_now_ns();
+        for (int n = 0; n < iterations; n++) {
+            bench_write_frame(0x0005, payload, length);
+        }
+        double frame_ns = (double) (bench_now_ns() - start) / iterations;
+
+        printf("%8zu %14.0f %10.1f %14.0f %10.1f %7.1fx\n", length,
+               per_byte_ns, length * 1000.0 / per_byte_ns, frame_ns, length * 1000.0 / frame_ns, per_byte_ns / frame_ns);
+    }
+}
+
+// ============================ rx parser ============================
+static size_t bench_frames_seen = 0;
+
+// only counts intact frames, a fragment cut at a read boundary fails the header length check
+static void bench_frame_handler(uint8_t *frame, size_t length) {
+    if (length >= 4 && frame[0] == 0x01 && frame[1] == 0x00 && ((frame[2] << 8) | frame[3]) == length - 4) {
+        bench_frames_seen += 1;
+    }
+}
+
+// rx_task() before the incremental parser, clear the read buffer, scan all of it, decode in a second pass
+// and lose any frame split across two reads
+static void bench_parse_whole_buffer(uint8_t *data) {
+    int cmd_start = 0;
+    int cmd_end = 0;
+
+    for (int i = 0; i < BENCH_UART_BUF_SIZE; i++) {
+        if (data[i] == UART_START) {
+            cmd_start = i + 1;
+        } else if (data[i] == UART_END) {
+            cmd_end = i;
+        }
+
+        if (cmd_end > cmd_start) {
+            uint8_t *command = data + cmd_start;
+            size_t cmd_len = uart_decoded_bytes(command, cmd_end - cmd_start, command);
+            bench_frame_handler(command, cmd_len);
+            cmd_start = cmd_end;
+        }
+    }
+}
+
+// host command frames, binary send opcode + flags + len16 + address + random payload of 8 to 120 bytes
+static size_t bench_build_rx_stream(uint8_t *stream, size_t stream_size, size_t *frame_count) {
+    uint8_t command[4 + NODE_ADDR_LEN + 120];
+    size_t stream_len = 0;
+
+    *frame_count = 0;
+    while (1) {
+        size_t payload_len = 8 + rand() % 113;
+        size_t command_len = 4 + NODE_ADDR_LEN + payload_len;
+        bench_fill_random(command, command_len);
+        command[0] = 0x01;
+        command[1] = 0x00;
+        command[2] = (command_len - 4) >> 8;
+        command[3] = (command_len - 4) & 0xFF;
+        if (stream_size - stream_len < 2 + 2 * command_len) {
+            return stream_len;
+        }
+        stream[stream_len++] = UART_START;
+        stream_len += uart_encode_bytes(command, command_len, stream + stream_len);
+        stream[stream_len++] = UART_END;
+        *frame_count += 1;
+    }
+}
+
+static void bench_parse(void) {
+    static uint8_t stream[BENCH_RX_STREAM_LEN];
+    static uint8_t data[BENCH_UART_BUF_SIZE + 1];
+    static uart_frame_parser_t parser;
+    static const size_t max_chunks[] = {16, 128, BENCH_UART_BUF_SIZE};
+    const int rounds = 20;
+    size_t frame_count;
+    size_t stream_len = bench_build_rx_stream(stream, sizeof(stream), &frame_count);
+
+    printf("rx parser, %zu bytes of %zu frames per round, reads of 1 to max bytes\n", stream_len, frame_count);
+    printf("%8s %14s %10s %12s %14s %10s %12s\n",
+           "max read", "old ns/read", "MB/s", "frames ok", "feed ns/read", "MB/s", "frames ok");
+    for (size_t i = 0; i < sizeof(max_chunks) / sizeof(max_chunks[0]); i++) {
+        // same random read boundaries for both parsers
+        size_t reads = 0;
+        int64_t old_ns = 0;
+        int64_t feed_ns = 0;
+        size_t old_frames = 0;
+        size_t feed_frames = 0;
+
+        for (int round = 0; round < rounds; round++) {
+            unsigned int seed = round * 7919 + i;
+            int64_t start = bench_now_ns();
+            bench_frames_seen = 0;
+            for (size_t offset = 0; offset < stream_len;) {
+                size_t chunk = 1 + rand_r(&seed) % max_chunks[i];
+                chunk = chunk < stream_len - offset ? chunk : stream_len - offset;
+                memset(data, 0, BENCH_UART_BUF_SIZE);
+                memcpy(data, stream + offset, chunk);
+                bench_parse_whole_buffer(data);
+                offset += chunk;
+            }
+            old_ns += bench_now_ns() - start;
+            old_frames += bench_frames_seen;
+
+            seed = round * 7919 + i;
+            uart_parser_init(&parser);
+            start = bench_now_ns();
+            bench_frames_seen = 0;
+            for (size_t offset = 0; offset < stream_len;) {
+                size_t chunk = 1 + rand_r(&seed) % max_chunks[i];
+                chunk = chunk < stream_len - offset ? chunk : stream_len - offset;
+                memcpy(data, stream + offset, chunk);
+                uart_parser_feed(&parser, data, chunk, bench_frame_handler);
+                offset += chunk;
+                reads += 1;
+            }
+            feed_ns += bench_now_ns() - start;
+            feed_frames += bench_frames_seen;
+        }
+
+        double total_mb = (double) stream_len * rounds / 1000000.0;
+        printf("%8zu %14.0f %10.1f %11.1f%% %14.0f %10.1f %11.1f%%\n", max_chunks[i],
+               (double) old_ns / reads, total_mb * 1e9 / old_ns, 100.0 * old_frames / (frame_count * rounds),
+               (double) feed_ns / reads, total_mb * 1e9 / feed_ns, 100.0 * feed_frames / (frame_count * rounds));
+    }
+}
+
+// ============================ local edge device send path ============================
+static volatile uint32_t bench_sent_sum = 0;
+
+// stands in for send_message(), both paths end here
+__attribute__((noinline)) static int bench_mesh_send_message(uint16_t dst_address, uint16_t length, uint8_t *data_ptr) {
+    bench_sent_sum += dst_address + length + data_ptr[0] + data_ptr[length - 1];
+    return 0;
+}
+
+// execute_uart_command() "SEND-" branch, parses the address back out of the command string
+__attribute__((noinline)) static void bench_execute_send_command(char *command, size_t cmd_total_len) {
+    if (cmd_total_len < CMD_LEN || strncmp(command, "SEND-", CMD_LEN) != 0) {
+        return;
+    }
+    char *address_start = command + CMD_LEN;
+    char *msg_start = address_start + NODE_ADDR_LEN;
+    size_t msg_length = cmd_total_len - CMD_LEN - NODE_ADDR_LEN;
+
+    uint16_t node_addr = (uint16_t) (((uint8_t) address_start[0] << 8) | (uint8_t) address_start[1]);
+    if (node_addr == 0) {
+        node_addr = 0x0001;
+    }
+    bench_mesh_send_message(node_addr, msg_length, (uint8_t *) msg_start);
+}
+
+// ble_send_to_root() before mesh_send(), serialises "SEND-" + address + payload into a cleared buffer
+__attribute__((noinline)) static void bench_send_via_command(uint8_t *data_buffer, size_t data_length) {
+    uint8_t command_msg[BENCH_MAX_MSG_LEN + CMD_LEN + NODE_ADDR_LEN];
+    memset(command_msg, 0, sizeof(command_msg));
+    uint8_t *msg_itr = command_msg;
+
+    memcpy(msg_itr, "SEND-", CMD_LEN);
+    msg_itr += CMD_LEN;
+    msg_itr[0] = 0;
+    msg_itr[1] = 0;
+    msg_itr += NODE_ADDR_LEN;
+    memcpy(msg_itr, data_buffer, data_length);
+    msg_itr += data_length;
+
+    bench_execute_send_command((char *) command_msg, msg_itr - command_msg);
+}
+
+// mesh_send(), straight to the send layer
+__attribute__((noinline)) static void bench_send_direct(uint8_t *data_buffer, size_t data_length) {
+    bench_mesh_send_message(0x0001, data_length, data_buffer);
+}
+
+static void bench_send(void) {
+    static const size_t payload_lens[] = {16, 64, 256};
+    static uint8_t payload[BENCH_MAX_MSG_LEN];
+    const int iterations = 2000000;
+
+    printf("local edge device send, ns per message, cpu us per second at 50 Hz\n");
+    printf("%8s %12s %12s %10s %14s\n", "payload", "command ns", "direct ns", "saved ns", "saved us@50Hz");
+    for (size_t i = 0; i < sizeof(payload_lens) / sizeof(payload_lens[0]); i++) {
+        size_t length = payload_lens[i];
+        bench_fill_random(payload, length);
+
+        int64_t start = bench_now_ns();
+        for (int n = 0; n < iterations; n++) {
+            bench_send_via_command(payload, length);
+        }
+        double command_ns = (double) (bench_now_ns() - start) / iterations;
+
+        start = bench_now_ns();
+        for (int n = 0; n < iterations; n++) {
+            bench_send_direct(payload, length);
+        }
+        double direct_ns = (double) (bench_now_ns() - start) / iterations;
+
+        printf("%8zu %12.1f %12.1f %10.1f %14.2f\n", length, command_ns, direct_ns,
+               command_ns - direct_ns, (command_ns - direct_ns) * 50 / 1000.0);
+    }
+}
+
+// ============================ rx dispatch latency ============================
+// driver rx ring fed by a host thread, read either like uart_read_bytes() with a timeout or on UART_PATTERN_DET
+static pthread_mutex_t bench_rx_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bench_rx_cond = PTHREAD_COND_INITIALIZER;
+static uint8_t bench_rx_ring[4 * BENCH_UART_BUF_SIZE];
+static size_t bench_rx_head = 0;
+static size_t bench_rx_tail = 0;
+static size_t bench_rx_patterns = 0;    // UART_END bytes received and not yet read
+static bool bench_rx_done = false;
+static int64_t bench_rx_end_ns[BENCH_RX_FRAMES]; // time each frame's end byte reached the driver
+static int64_t bench_rx_latency_ns[BENCH_RX_FRAMES];
+static size_t bench_rx_dispatched = 0;
+
+static size_t bench_rx_buffered(void) {
+    return (bench_rx_head - bench_rx_tail + sizeof(bench_rx_ring)) % sizeof(bench_rx_ring);
+}
+
+// host side, one command every 5 to 35 ms, about the 50 Hz telemetry rate
+static void *bench_rx_host_thread(void *arg) {
+    uint8_t command[4 + NODE_ADDR_LEN + 32];
+    uint8_t frame[2 + 2 * sizeof(command)];
+
+    for (uint16_t seq = 0; seq < BENCH_RX_FRAMES; seq++) {
+        struct timespec gap = {0, (5 + rand() % 31) * 1000000L};
+        nanosleep(&gap, NULL);
+
+        bench_fill_random(command, sizeof(command));
+        command[0] = 0x01;
+        command[1] = 0x00;
+        command[2] = 0;
+        command[3] = sizeof(command) - 4;
+        command[4] = seq >> 8;
+        command[5] = seq & 0xFF;
+        size_t frame_len = 0;
+        frame[frame_len++] = UART_START;
+        frame_len += uart_encode_bytes(command, sizeof(command), frame + frame_len);
+        frame[frame_len++] = UART_END;
+
+        pthread_mutex_lock(&bench_rx_lock);
+        for (size_t i = 0; i < frame_len; i++) {
+            bench_rx_ring[bench_rx_head] = frame[i];
+            bench_rx_head = (bench_rx_head + 1) % sizeof(bench_rx_ring);
+        }
+        bench_rx_end_ns[seq] = bench_now_ns();
+        bench_rx_patterns += 1;
+        pthread_cond_signal(&bench_rx_cond);
+        pthread_mutex_unlock(&bench_rx_lock);
+    }
+
+    pthread_mutex_lock(&bench_rx_lock);
+    bench_rx_done = true;
+    pthread_cond_signal(&bench_rx_cond);
+    pthread_mutex_unlock(&bench_rx_lock);
+    return NULL;
+}
+
+static size_t bench_rx_copy_out(uint8_t *data, size_t length) {
+    size_t read_len = bench_rx_buffered() < length ? bench_rx_buffered() : length;
+    for (size_t i = 0; i < read_len; i++) {
+        data[i] = bench_rx_ring[bench_rx_tail];
+        bench_rx_tail = (bench_rx_tail + 1) % sizeof(bench_rx_ring);
+    }
+    return read_len;
+}
+
+// uart_read_bytes() only returns early once length bytes arrived
+static size_t bench_rx_read_polling(uint8_t *data, size_t length) {
+    int64_t deadline = bench_now_ns() + BENCH_RX_READ_TIMEOUT_NS;
+    struct timespec abs_deadline;
+    clock_gettime(CLOCK_REALTIME, &abs_deadline);
+    abs_deadline.tv_sec += 1;
+
+    pthread_mutex_lock(&bench_rx_lock);
+    while (bench_rx_buffered() < length && !bench_rx_done && bench_now_ns() < deadline) {
+        pthread_cond_timedwait(&bench_rx_cond, &bench_rx_lock, &abs_deadline);
+    }
+    size_t read_len = bench_rx_copy_out(data, length);
+    pthread_mutex_unlock(&bench_rx_lock);
+    return read_len;
+}
+
+// wait for UART_PATTERN_DET, then drain everything buffered like rx_read_buffered()
+static size_t bench_rx_read_event(uint8_t *data, size_t length) {
+    pthread_mutex_lock(&bench_rx_lock);
+    while (bench_rx_patterns == 0 && !bench_rx_done) {
+        pthread_cond_wait(&bench_rx_cond, &bench_rx_lock);
+    }
+    bench_rx_patterns = 0;
+    size_t read_len = bench_rx_copy_out(data, length);
+    pthread_mutex_unlock(&bench_rx_lock);
+    return read_len;
+}
+
+static void bench_rx_frame_handler(uint8_t *frame, size_t length) {
+    uint16_t seq = (frame[4] << 8) | frame[5];
+    if (seq < BENCH_RX_FRAMES) {
+        bench_rx_latency_ns[bench_rx_dispatched++] = bench_now_ns() - bench_rx_end_ns[seq];
+    }
+}
+
+static int bench_cmp_int64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *) a;
+    int64_t y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void bench_rx_run(const char *name, size_t (*read_fn)(uint8_t *data, size_t length)) {
+    static uint8_t data[BENCH_UART_BUF_SIZE];
+    static uart_frame_parser_t parser;
+    pthread_t host_thread;
+
+    bench_rx_head = bench_rx_tail = bench_rx_patterns = bench_rx_dispatched = 0;
+    bench_rx_done = false;
+    uart_parser_init(&parser);
+    pthread_create(&host_thread, NULL, bench_rx_host_thread, NULL);
+
+    while (1) {
+        size_t rxBytes = read_fn(data, sizeof(data));
+        if (rxBytes > 0) {
+            uart_parser_feed(&parser, data, rxBytes, bench_rx_frame_handler);
+        }
+        pthread_mutex_lock(&bench_rx_lock);
+        bool done = bench_rx_done && bench_rx_buffered() == 0;
+        pthread_mutex_unlock(&bench_rx_lock);
+        if (done) {
+            break;
+        }
+    }
+    pthread_join(host_thread, NULL);
+
+    qsort(bench_rx_latency_ns, bench_rx_dispatched, sizeof(bench_rx_latency_ns[0]), bench_cmp_int64);
+    printf("%8s %10zu %12.1f %12.1f %12.1f\n", name, bench_rx_dispatched,
+           bench_rx_latency_ns[bench_rx_dispatched / 2] / 1000.0,
+           bench_rx_latency_ns[bench_rx_dispatched * 99 / 100] / 1000.0,
+           bench_rx_latency_ns[bench_rx_dispatched - 1] / 1000.0);
+}
+
+static void bench_rx(void) {
+    printf("rx dispatch latency, frame end byte received to frame handler, %d commands 5 to 35 ms apart\n", BENCH_RX_FRAMES);
+    printf("%8s %10s %12s %12s %12s\n", "mode", "frames", "p50 us", "p99 us", "max us");
+    bench_rx_run("polling", bench_rx_read_polling);
+    bench_rx_run("event", bench_rx_read_event);
+}
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "all";
+    srand(1);
+
+    if (strcmp(mode, "all") == 0 || strcmp(mode, "write") == 0) {
+        bench_write();
+    }
+    if (strcmp(mode, "all") == 0 || strcmp(mode, "parse") == 0) {
+        bench_parse();
+    }
+    if (strcmp(mode, "all") == 0 || strcmp(mode, "send") == 0) {
+        bench_send();
+    }
+    if (strcmp(mode, "all") == 0 || strcmp(mode, "rx") == 0) {
+        bench_rx();
+    }
+    return 0;
+}